@@ -0,0 +1,128 @@
+/*
+ * Minimal Arduino core for native builds
+ */
+
+#include "Arduino.h"
+
+NativeSerial Serial;
+
+static uint64_t now_us;
+
+unsigned long millis() { return (unsigned long)(uint32_t)(now_us / 1000); }
+unsigned long micros() { return (unsigned long)(uint32_t)now_us; }
+void delay(unsigned long ms) { now_us += (uint64_t)ms * 1000; }
+void delayMicroseconds(unsigned int us) { now_us += us; }
+
+// ============== Serial ==============
+
+static uint64_t idle_us;  // Idle time since the last output
+
+static void session_end() {
+  fflush(stdout);
+  fprintf(stderr, "[native] virtual time: %lu ms\n", (unsigned long)((now_us - idle_us) / 1000));
+  exit(0);
+}
+
+static int lookahead = -1;
+static bool input_done;
+static bool line_start = true;
+static uint64_t gap_until;  // No input before this time
+
+// Next input byte; a line "@N" is a pause of N ms and is not delivered
+static int next_input() {
+  int c = getchar();
+
+  while (line_start && c == '@') {
+    unsigned long ms = 0;
+    while ((c = getchar()) >= '0' && c <= '9') ms = ms * 10 + (c - '0');
+    while (c != '\n' && c != EOF) c = getchar();
+    gap_until = now_us + (uint64_t)ms * 1000;
+    if (c == EOF) return EOF;
+    c = getchar();
+  }
+  line_start = (c == '\n');
+  return c;
+}
+
+// Blocks until a byte arrives. Each input line arrives as its own burst:
+// after a newline one poll reports nothing, as if the next line were typed
+// later. Once stdin is exhausted every poll counts as 1 ms of idle time so
+// background tasks keep running; the session ends after 10 minutes without
+// output (not included in the reported time).
+int NativeSerial::available() {
+  if (now_us < gap_until) {
+    now_us += 1000;
+    return 0;
+  }
+  if (lookahead < 0 && !input_done) {
+    fflush(stdout);
+    lookahead = next_input();
+    if (lookahead == EOF) {
+      lookahead = -1;
+      input_done = true;
+    }
+    if (now_us < gap_until) return 0;
+  }
+  if (lookahead >= 0) return 1;
+
+  now_us += 1000;
+  idle_us += 1000;
+  if (idle_us > 600000000ULL) session_end();
+  return 0;
+}
+
+int NativeSerial::read() {
+  if (!available()) return -1;
+  int c = lookahead;
+  lookahead = -1;
+  if (c == '\n') gap_until = now_us + 1000;
+  return c;
+}
+
+int NativeSerial::peek() {
+  return available() ? lookahead : -1;
+}
+
+size_t NativeSerial::write(uint8_t c) {
+  idle_us = 0;
+  return fputc(c, stdout) == EOF ? 0 : 1;
+}
+
+size_t NativeSerial::write(const uint8_t* buf, size_t len) {
+  idle_us = 0;
+  return fwrite(buf, 1, len, stdout);
+}
+
+size_t NativeSerial::printNumber(unsigned long n, int base) {
+  char buf[33];
+  char* p = buf + sizeof(buf) - 1;
+  uint32_t v = (uint32_t)n;  // AVR longs are 32-bit
+
+  *p = '\0';
+  do {
+    uint8_t d = v % base;
+    *--p = d < 10 ? '0' + d : 'A' + d - 10;
+    v /= base;
+  } while (v);
+  return write(p);
+}
+
+size_t NativeSerial::printSigned(long n, int base) {
+  if (base == DEC && n < 0) {
+    return write('-') + printNumber(-n, DEC);
+  }
+  return printNumber((unsigned long)(uint32_t)n, base);
+}
+
+size_t NativeSerial::print(double n, int digits) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+// ============== Entry point ==============
+
+int main() {
+  setup();
+  for (;;) loop();
+}
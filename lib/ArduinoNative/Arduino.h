@@ -0,0 +1,106 @@
+/*
+ * Minimal Arduino core for native builds
+ *
+ * Just enough of the Arduino API for the firmware sources to compile and run
+ * on the host. Time is virtual: delay() and delayMicroseconds() advance a
+ * counter instead of sleeping, so a simulated session runs at full speed and
+ * millis()/micros() report what the board would have spent. Serial reads
+ * stdin line by line and writes stdout; an input line "@N" waits N ms of
+ * virtual time before the next line. The program exits once stdin is
+ * exhausted and the firmware has gone quiet.
+ */
+
+#ifndef ARDUINO_NATIVE_H
+#define ARDUINO_NATIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+// Flash access - plain memory on the host
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr)  (*(const uint8_t*)(addr))
+#define pgm_read_word(addr)  (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define pgm_read_ptr(addr)   (*(void* const*)(addr))
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+#define strlen_P strlen
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+// Virtual clock
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// Pins are not modelled; the HAL handles the battery side
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return HIGH; }
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+class NativeSerial {
+  public:
+    void begin(unsigned long baud) { (void)baud; }
+    void end() {}
+    operator bool() { return true; }
+
+    int available();
+    int read();
+    int peek();
+    int availableForWrite() { return 63; }
+    void flush() { fflush(stdout); }
+
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buf, size_t len);
+    size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+
+    size_t print(const __FlashStringHelper* s) { return print(reinterpret_cast<const char*>(s)); }
+    size_t print(const char* s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return printNumber(n, base); }
+    size_t print(int n, int base = DEC) { return printSigned(n, base); }
+    size_t print(unsigned int n, int base = DEC) { return printNumber(n, base); }
+    size_t print(long n, int base = DEC) { return printSigned(n, base); }
+    size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+    size_t print(double n, int digits = 2);
+
+    size_t println() { return write('\n'); }
+    template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(T v, int fmt) { size_t n = print(v, fmt); return n + println(); }
+
+  private:
+    size_t printNumber(unsigned long n, int base);
+    size_t printSigned(long n, int base);
+};
+
+extern NativeSerial Serial;
+
+// Sketch entry points
+void setup();
+void loop();
+
+#endif
@@ -0,0 +1,40 @@
+/*
+ * EEPROM for native builds
+ */
+
+#include "EEPROM.h"
+
+EEPROMClass EEPROM;
+
+void EEPROMClass::load() {
+  const char* path = getenv("MAKITA_SIM_EEPROM");
+
+  memset(mem, 0xFF, sizeof(mem));
+  loaded = true;
+  if (!path) return;
+
+  FILE* f = fopen(path, "rb");
+  if (!f) return;
+  size_t n = fread(mem, 1, sizeof(mem), f);
+  (void)n;
+  fclose(f);
+}
+
+uint8_t EEPROMClass::read(int idx) {
+  if (!loaded) load();
+  return (idx >= 0 && idx < (int)sizeof(mem)) ? mem[idx] : 0xFF;
+}
+
+void EEPROMClass::write(int idx, uint8_t val) {
+  const char* path = getenv("MAKITA_SIM_EEPROM");
+
+  if (!loaded) load();
+  if (idx < 0 || idx >= (int)sizeof(mem)) return;
+  mem[idx] = val;
+  if (!path) return;
+
+  FILE* f = fopen(path, "wb");
+  if (!f) return;
+  fwrite(mem, 1, sizeof(mem), f);
+  fclose(f);
+}
@@ -0,0 +1,41 @@
+/*
+ * EEPROM for native builds
+ *
+ * 1 KB like the ATmega328P, erased to 0xFF. Set MAKITA_SIM_EEPROM to a file
+ * name to keep the contents between runs.
+ */
+
+#ifndef ARDUINO_NATIVE_EEPROM_H
+#define ARDUINO_NATIVE_EEPROM_H
+
+#include "Arduino.h"
+
+class EEPROMClass {
+  public:
+    uint8_t read(int idx);
+    void write(int idx, uint8_t val);
+    void update(int idx, uint8_t val) { if (read(idx) != val) write(idx, val); }
+    uint16_t length() { return sizeof(mem); }
+
+    template <typename T> T& get(int idx, T& t) {
+      uint8_t* p = (uint8_t*)&t;
+      for (size_t i = 0; i < sizeof(T); i++) p[i] = read(idx + i);
+      return t;
+    }
+
+    template <typename T> const T& put(int idx, const T& t) {
+      const uint8_t* p = (const uint8_t*)&t;
+      for (size_t i = 0; i < sizeof(T); i++) update(idx + i, p[i]);
+      return t;
+    }
+
+  private:
+    uint8_t mem[1024];
+    bool loaded;
+
+    void load();
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -39,6 +39,20 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #  define CRIT_TIMING
 #endif
 
+#define ONEWIRE_DEFAULT_TIMING { \
+	ONEWIRE_RESET_LOW, ONEWIRE_RESET_SAMPLE, ONEWIRE_RESET_TAIL, \
+	ONEWIRE_W1_LOW, ONEWIRE_W1_HIGH, \
+	ONEWIRE_W0_LOW, ONEWIRE_W0_HIGH, \
+	ONEWIRE_R_LOW, ONEWIRE_R_SAMPLE, ONEWIRE_R_TAIL }
+
+static const OneWireTiming default_timings PROGMEM = ONEWIRE_DEFAULT_TIMING;
+
+OneWireTiming OneWire::timing = ONEWIRE_DEFAULT_TIMING;
+
+void OneWire::default_timing(OneWireTiming *t)
+{
+	memcpy_P(t, &default_timings, sizeof(OneWireTiming));
+}
 
 void OneWire::begin(uint8_t pin)
 {
@@ -69,14 +83,13 @@ uint8_t CRIT_TIMING OneWire::reset(void)
 	DIRECT_WRITE_LOW(reg, mask);
 	DIRECT_MODE_OUTPUT(reg, mask);
 	interrupts();
-	// OBI modification, was 480
-	delayMicroseconds(750);
+	delayMicroseconds(timing.reset_low);
 	noInterrupts();
 	DIRECT_MODE_INPUT(reg, mask);
-	delayMicroseconds(70);
+	delayMicroseconds(timing.reset_sample);
 	r = !DIRECT_READ(reg, mask);
 	interrupts();
-	delayMicroseconds(410);
+	delayMicroseconds(timing.reset_tail);
 	return r;
 }
 
@@ -89,22 +102,18 @@ void CRIT_TIMING OneWire::write_bit(uint8_t v)
 		noInterrupts();
 		DIRECT_WRITE_LOW(reg, mask);
 		DIRECT_MODE_OUTPUT(reg, mask);
-		// OBI modification, was 10
-		delayMicroseconds(12);
+		delayMicroseconds(timing.w1_low);
 		DIRECT_WRITE_HIGH(reg, mask);
 		interrupts();
-		// OBI modification, was 55
-		delayMicroseconds(120);
+		delayMicroseconds(timing.w1_high);
 	} else {
 		noInterrupts();
 		DIRECT_WRITE_LOW(reg, mask);
 		DIRECT_MODE_OUTPUT(reg, mask);
-		// OBI modification, was 65
-		delayMicroseconds(100);
+		delayMicroseconds(timing.w0_low);
 		DIRECT_WRITE_HIGH(reg, mask);
 		interrupts();
-		// OBI modification, was 5
-		delayMicroseconds(30);
+		delayMicroseconds(timing.w0_high);
 	}
 }
 
@@ -117,13 +126,12 @@ uint8_t CRIT_TIMING OneWire::read_bit(void)
 	noInterrupts();
 	DIRECT_MODE_OUTPUT(reg, mask);
 	DIRECT_WRITE_LOW(reg, mask);
-	// OBI modification, was 3
-	delayMicroseconds(10);
+	delayMicroseconds(timing.r_low);
 	DIRECT_MODE_INPUT(reg, mask);
-	delayMicroseconds(10);
+	delayMicroseconds(timing.r_sample);
 	r = DIRECT_READ(reg, mask);
 	interrupts();
-	delayMicroseconds(53);
+	delayMicroseconds(timing.r_tail);
 	return r;
 }
 
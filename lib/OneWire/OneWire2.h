@@ -32,6 +32,34 @@
 #define ONEWIRE_CRC16 1
 #endif
 
+// Makita slot timings in microseconds (OBI modification, standard 1-Wire
+// value in brackets). These are the defaults of OneWire::timing, which is
+// shared by the blocking driver and OneWireAsync.
+#define ONEWIRE_RESET_LOW     750  // [480]
+#define ONEWIRE_RESET_SAMPLE   70
+#define ONEWIRE_RESET_TAIL    410
+#define ONEWIRE_W1_LOW         12  // [10]
+#define ONEWIRE_W1_HIGH       120  // [55]
+#define ONEWIRE_W0_LOW        100  // [65]
+#define ONEWIRE_W0_HIGH        30  // [5]
+#define ONEWIRE_R_LOW          10  // [3]
+#define ONEWIRE_R_SAMPLE       10
+#define ONEWIRE_R_TAIL         53
+
+// Runtime slot timings in microseconds
+struct OneWireTiming {
+    uint16_t reset_low;
+    uint16_t reset_sample;
+    uint16_t reset_tail;
+    uint8_t w1_low;
+    uint8_t w1_high;
+    uint8_t w0_low;
+    uint8_t w0_high;
+    uint8_t r_low;
+    uint8_t r_sample;
+    uint8_t r_tail;
+};
+
 #include "util/OneWire_direct_regtype.h"
 
 class OneWire
@@ -63,6 +91,10 @@ class OneWire
     uint8_t read_bit(void);
     void depower(void);
 
+    // Current slot timings; change them only while the bus is idle
+    static OneWireTiming timing;
+    static void default_timing(OneWireTiming *t);
+
 #if ONEWIRE_SEARCH
     void reset_search();
     void target_search(uint8_t family_code);
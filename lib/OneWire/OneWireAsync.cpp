@@ -0,0 +1,209 @@
+/*
+Timer1 driven, non-blocking variant of the OneWire slot engine.
+
+Slot timings come from OneWire::timing (Makita defaults in OneWire2.h).
+Timer1 runs free at clk/8; every event is scheduled relative to the previous
+compare match (OCR1A += ticks), so ISR entry latency does not accumulate
+across slots.
+*/
+
+#include <Arduino.h>
+#include "OneWireAsync.h"
+
+#if ONEWIRE_ASYNC
+
+#include <avr/interrupt.h>
+#include "util/OneWire_direct_gpio.h"
+
+#define TICKS_PER_US   (F_CPU / 8000000UL)
+#define US_TO_TICKS(us) ((uint16_t)((us) * TICKS_PER_US))
+
+// Register save/restore and the call into service(), per ISR invocation
+#define ISR_OVERHEAD_CYCLES 60
+
+enum {
+	OWA_IDLE = 0,
+	OWA_RESET_RELEASE,
+	OWA_RESET_SAMPLE,
+	OWA_WRITE0_RECOVER,
+	OWA_SLOT
+};
+
+OneWireAsync *volatile OneWireAsync::active = 0;
+
+ISR(TIMER1_COMPA_vect)
+{
+	OneWireAsync *owa = OneWireAsync::active;
+	if (owa) owa->service();
+}
+
+static inline void schedule(uint16_t us)
+{
+	OCR1A += US_TO_TICKS(us);
+}
+
+void OneWireAsync::begin(uint8_t pin)
+{
+	pinMode(pin, INPUT);
+	bitmask = PIN_TO_BITMASK(pin);
+	baseReg = PIN_TO_BASEREG(pin);
+	state = OWA_IDLE;
+	result = ONEWIRE_ASYNC_OK;
+}
+
+bool OneWireAsync::start(const OneWireSegment *segs, uint8_t count, uint16_t gap_us, Callback cb)
+{
+	uint8_t retries = 125;
+
+	if (active) return false;
+
+	seg = segs;
+	seg_left = count;
+	byte_pos = 0;
+	bit_mask = 0x01;
+	gap = gap_us;
+	done_cb = cb;
+	isr_ticks = 0;
+	isr_calls = 0;
+
+	// Wait for the bus to be released, same limit as OneWire::reset()
+	noInterrupts();
+	DIRECT_MODE_INPUT(baseReg, bitmask);
+	interrupts();
+	do {
+		if (--retries == 0) {
+			result = ONEWIRE_ASYNC_NO_PRESENCE;
+			if (cb) cb(result);
+			return true;
+		}
+		delayMicroseconds(2);
+	} while (!DIRECT_READ(baseReg, bitmask));
+
+	active = this;
+	result = ONEWIRE_ASYNC_BUSY;
+	state = OWA_RESET_RELEASE;
+
+	noInterrupts();
+	DIRECT_WRITE_LOW(baseReg, bitmask);
+	DIRECT_MODE_OUTPUT(baseReg, bitmask);
+	TCCR1A = 0;
+	TCCR1B = _BV(CS11);  // Normal mode, clk/8
+	OCR1A = TCNT1 + US_TO_TICKS(OneWire::timing.reset_low);
+	TIFR1 = _BV(OCF1A);
+	TIMSK1 |= _BV(OCIE1A);
+	interrupts();
+	return true;
+}
+
+uint32_t OneWireAsync::cpu_cycles() const
+{
+	return isr_ticks * 8 + (uint32_t)isr_calls * ISR_OVERHEAD_CYCLES;
+}
+
+void OneWireAsync::service()
+{
+	uint16_t t0 = TCNT1;
+
+	switch (state) {
+	case OWA_RESET_RELEASE:
+		DIRECT_MODE_INPUT(baseReg, bitmask);
+		schedule(OneWire::timing.reset_sample);
+		state = OWA_RESET_SAMPLE;
+		break;
+
+	case OWA_RESET_SAMPLE:
+		if (DIRECT_READ(baseReg, bitmask)) {
+			finish(ONEWIRE_ASYNC_NO_PRESENCE);
+			break;
+		}
+		schedule(OneWire::timing.reset_tail + gap);
+		state = OWA_SLOT;
+		break;
+
+	case OWA_WRITE0_RECOVER:
+		DIRECT_WRITE_HIGH(baseReg, bitmask);
+		schedule(OneWire::timing.w0_high);
+		state = OWA_SLOT;
+		break;
+
+	case OWA_SLOT:
+		next_slot();
+		break;
+	}
+
+	isr_ticks += (uint16_t)(TCNT1 - t0);
+	isr_calls++;
+}
+
+void OneWireAsync::next_slot()
+{
+	while (seg_left && byte_pos == seg->len) {
+		if (onewire_seg_dead(seg)) {
+			finish(ONEWIRE_ASYNC_NO_ANSWER);
+			return;
+		}
+		end_segment();
+	}
+	if (!seg_left) {
+		finish(ONEWIRE_ASYNC_OK);
+		return;
+	}
+
+	const OneWireTiming &t = OneWire::timing;
+	uint8_t *p = seg->buf + byte_pos;
+
+	if (seg->read) {
+		// Read slot - low and sample edges are timed inline
+		DIRECT_MODE_OUTPUT(baseReg, bitmask);
+		DIRECT_WRITE_LOW(baseReg, bitmask);
+		delayMicroseconds(t.r_low);
+		DIRECT_MODE_INPUT(baseReg, bitmask);
+		delayMicroseconds(t.r_sample);
+		if (DIRECT_READ(baseReg, bitmask)) *p |= bit_mask;
+		else *p &= ~bit_mask;
+		schedule(t.r_low + t.r_sample + t.r_tail);
+	} else if (*p & bit_mask) {
+		DIRECT_WRITE_LOW(baseReg, bitmask);
+		DIRECT_MODE_OUTPUT(baseReg, bitmask);
+		delayMicroseconds(t.w1_low);
+		DIRECT_WRITE_HIGH(baseReg, bitmask);
+		schedule(t.w1_low + t.w1_high);
+	} else {
+		// Write-0 low time runs in the background
+		DIRECT_WRITE_LOW(baseReg, bitmask);
+		DIRECT_MODE_OUTPUT(baseReg, bitmask);
+		schedule(t.w0_low);
+		state = OWA_WRITE0_RECOVER;
+	}
+
+	bit_mask <<= 1;
+	if (!bit_mask) {
+		bit_mask = 0x01;
+		byte_pos++;
+	}
+}
+
+void OneWireAsync::end_segment()
+{
+	if (!seg->read) {
+		// Release the line after writing, as OneWire::write() does
+		DIRECT_MODE_INPUT(baseReg, bitmask);
+		DIRECT_WRITE_LOW(baseReg, bitmask);
+	}
+	seg++;
+	seg_left--;
+	byte_pos = 0;
+}
+
+void OneWireAsync::finish(uint8_t status)
+{
+	TIMSK1 &= ~_BV(OCIE1A);
+	DIRECT_MODE_INPUT(baseReg, bitmask);
+	DIRECT_WRITE_LOW(baseReg, bitmask);
+	state = OWA_IDLE;
+	result = status;
+	active = 0;
+	if (done_cb) done_cb(status);
+}
+
+#endif // ONEWIRE_ASYNC
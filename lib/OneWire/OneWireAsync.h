@@ -0,0 +1,101 @@
+#ifndef OneWireAsync_h
+#define OneWireAsync_h
+
+#ifdef __cplusplus
+
+#include <stdint.h>
+#include "OneWire2.h"
+
+// Timer1 compare-match driven OneWire engine.
+//
+// A transfer is a reset, an optional gap and a list of read/write segments.
+// Slot edges are clocked by TIMER1_COMPA; the CPU is free for the long parts
+// of every slot (write-0 low time, all recovery times, the whole reset). The
+// short, jitter-sensitive part of write-1 and read slots (<= 20 us) runs
+// inside the ISR so other interrupts cannot stretch it.
+//
+// One transfer at a time: the engine owns Timer1 while busy.
+
+#if defined(__AVR__) && defined(TIMSK1) && !defined(ONEWIRE_ASYNC)
+#define ONEWIRE_ASYNC 1
+#endif
+
+#ifndef ONEWIRE_ASYNC
+#define ONEWIRE_ASYNC 0
+#endif
+
+#define ONEWIRE_ASYNC_OK          0
+#define ONEWIRE_ASYNC_NO_PRESENCE 1
+#define ONEWIRE_ASYNC_BUSY        2
+#define ONEWIRE_ASYNC_NO_ANSWER   3  // A probe segment read all ones
+
+// A probe segment is read like any other, but if every bit comes back 1
+// (nobody pulled the line) the transfer ends there instead of clocking the
+// rest of a response that cannot be valid.
+#define ONEWIRE_SEG_PROBE 2
+
+struct OneWireSegment {
+    uint8_t *buf;
+    uint8_t len;
+    uint8_t read;   // 1 = read into buf, 0 = write from buf, 2 = probe
+};
+
+// True if seg is a probe that read nothing but ones
+static inline bool onewire_seg_dead(const OneWireSegment *seg)
+{
+    if (seg->read != ONEWIRE_SEG_PROBE || !seg->len) return false;
+    for (uint8_t i = 0; i < seg->len; i++) {
+        if (seg->buf[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+#if ONEWIRE_ASYNC
+
+class OneWireAsync
+{
+  public:
+    typedef void (*Callback)(uint8_t status);
+
+    OneWireAsync() { }
+    OneWireAsync(uint8_t pin) { begin(pin); }
+    void begin(uint8_t pin);
+
+    // Start reset + gap_us + segments. Segments must stay valid until done.
+    // Returns false if a transfer is already running.
+    bool start(const OneWireSegment *segs, uint8_t count, uint16_t gap_us = 0, Callback cb = 0);
+    bool busy() const { return state != 0; }
+    uint8_t status() const { return result; }
+
+    // CPU cycles spent in the ISR during the last transfer
+    uint32_t cpu_cycles() const;
+
+    // Called from TIMER1_COMPA_vect
+    void service();
+    static OneWireAsync *volatile active;
+
+  private:
+    uint8_t bitmask;
+    volatile uint8_t *baseReg;
+
+    volatile uint8_t state;
+    volatile uint8_t result;
+    const OneWireSegment *seg;
+    uint8_t seg_left;
+    uint8_t byte_pos;
+    uint8_t bit_mask;
+    uint16_t gap;
+    Callback done_cb;
+
+    uint32_t isr_ticks;
+    uint16_t isr_calls;
+
+    void next_slot();
+    void end_segment();
+    void finish(uint8_t status);
+};
+
+#endif // ONEWIRE_ASYNC
+
+#endif // __cplusplus
+#endif // OneWireAsync_h
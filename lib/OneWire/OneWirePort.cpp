@@ -0,0 +1,156 @@
+/*
+Bit-parallel variant of the OneWire slot driver, for battery racks.
+
+All lanes share one port: pulling the selected lines low and letting them go
+is one DDR write each, and a read slot samples every lane with one PIN read.
+In a write slot the lanes sending 0 and the lanes sending 1 go low together;
+the 1s are released after w1_low, the 0s after w0_low. Lines are only ever
+released, never driven high - the pull-ups bring them up.
+
+Working out which lanes send 0, and spreading a sample over the lanes'
+buffers, is done outside the timed part of the slot, so it only stretches
+the recovery time.
+*/
+
+#include <Arduino.h>
+#include "OneWirePort.h"
+
+#if defined(__AVR__)
+
+#include "util/OneWire_direct_gpio.h"
+
+uint8_t OneWirePort::begin(const uint8_t *pins, uint8_t count)
+{
+	uint8_t usable = 0;
+
+	if (count > ONEWIRE_PORT_LANES) count = ONEWIRE_PORT_LANES;
+	lanes = count;
+	baseReg = PIN_TO_BASEREG(pins[0]);
+
+	// A pin on another port keeps its lane number but never answers
+	for (uint8_t l = 0; l < count; l++) {
+		bit[l] = 0;
+		if (PIN_TO_BASEREG(pins[l]) != baseReg) continue;
+		pinMode(pins[l], INPUT);
+		bit[l] = PIN_TO_BITMASK(pins[l]);
+		DIRECT_WRITE_LOW(baseReg, bit[l]);
+		usable |= 1 << l;
+	}
+	return usable;
+}
+
+uint8_t OneWirePort::port_mask(uint8_t lane_mask) const
+{
+	uint8_t mask = 0;
+	for (uint8_t l = 0; l < lanes; l++, lane_mask >>= 1) {
+		if (lane_mask & 1) mask |= bit[l];
+	}
+	return mask;
+}
+
+uint8_t OneWirePort::to_lanes(uint8_t port_bits, uint8_t lane_mask) const
+{
+	uint8_t r = 0;
+	for (uint8_t l = 0, lb = 1; l < lanes; l++, lb <<= 1) {
+		if ((lane_mask & lb) && (port_bits & bit[l])) r |= lb;
+	}
+	return r;
+}
+
+uint8_t OneWirePort::reset(uint8_t lane_mask)
+{
+	volatile uint8_t *reg = baseReg;
+	uint8_t mask = port_mask(lane_mask);
+	uint8_t retries = 125;
+	uint8_t r;
+
+	noInterrupts();
+	DIRECT_MODE_INPUT(reg, mask);
+	interrupts();
+	while ((*reg & mask) != mask && --retries) delayMicroseconds(2);
+	mask &= *reg;
+	if (!mask) return 0;
+
+	noInterrupts();
+	DIRECT_MODE_OUTPUT(reg, mask);
+	interrupts();
+	delayMicroseconds(OneWire::timing.reset_low);
+	noInterrupts();
+	DIRECT_MODE_INPUT(reg, mask);
+	delayMicroseconds(OneWire::timing.reset_sample);
+	r = ~*reg & mask;
+	interrupts();
+	delayMicroseconds(OneWire::timing.reset_tail);
+	return to_lanes(r, lane_mask);
+}
+
+void OneWirePort::write_bytes(const uint8_t *buf, uint16_t count, uint8_t lane_mask, uint16_t stride)
+{
+	volatile uint8_t *reg = baseReg;
+	const OneWireTiming &t = OneWire::timing;
+	uint8_t mask = port_mask(lane_mask);
+	uint8_t zeros;
+
+	for (uint16_t i = 0; i < count; i++) {
+		for (uint8_t m = 0x01; m; m <<= 1) {
+			// Port bits of the lanes sending 0 in this slot
+			if (!stride) {
+				zeros = (buf[i] & m) ? 0 : mask;
+			} else {
+				zeros = 0;
+				const uint8_t *p = buf + i;
+				for (uint8_t l = 0, lb = 1; l < lanes; l++, lb <<= 1, p += stride) {
+					if ((lane_mask & lb) && !(*p & m)) zeros |= bit[l];
+				}
+			}
+
+			noInterrupts();
+			DIRECT_MODE_OUTPUT(reg, mask);
+			delayMicroseconds(t.w1_low);
+			if (zeros) {
+				DIRECT_MODE_INPUT(reg, mask & ~zeros);
+				if (t.w0_low > t.w1_low) delayMicroseconds(t.w0_low - t.w1_low);
+				DIRECT_MODE_INPUT(reg, zeros);
+				interrupts();
+				delayMicroseconds(t.w0_high);
+			} else {
+				DIRECT_MODE_INPUT(reg, mask);
+				interrupts();
+				delayMicroseconds(t.w1_high);
+			}
+		}
+	}
+}
+
+void OneWirePort::read_bytes(uint8_t *buf, uint16_t count, uint8_t lane_mask, uint16_t stride)
+{
+	volatile uint8_t *reg = baseReg;
+	const OneWireTiming &t = OneWire::timing;
+	uint8_t mask = port_mask(lane_mask);
+	uint8_t r;
+
+	for (uint16_t i = 0; i < count; i++) {
+		uint8_t *p = buf + i;
+		for (uint8_t l = 0, lb = 1; l < lanes; l++, lb <<= 1, p += stride) {
+			if (lane_mask & lb) *p = 0;
+		}
+
+		for (uint8_t m = 0x01; m; m <<= 1) {
+			noInterrupts();
+			DIRECT_MODE_OUTPUT(reg, mask);
+			delayMicroseconds(t.r_low);
+			DIRECT_MODE_INPUT(reg, mask);
+			delayMicroseconds(t.r_sample);
+			r = *reg;
+			interrupts();
+
+			p = buf + i;
+			for (uint8_t l = 0, lb = 1; l < lanes; l++, lb <<= 1, p += stride) {
+				if ((lane_mask & lb) && (r & bit[l])) *p |= m;
+			}
+			delayMicroseconds(t.r_tail);
+		}
+	}
+}
+
+#endif // __AVR__
@@ -0,0 +1,58 @@
+#ifndef OneWirePort_h
+#define OneWirePort_h
+
+#ifdef __cplusplus
+
+#include <stdint.h>
+#include "OneWire2.h"
+
+// Bit-parallel OneWire on up to 8 pins of one AVR port.
+//
+// Every slot edge is a single write to the port's DDR register and every
+// sample a single read of its PIN register, so all lanes are clocked
+// together and N packs take the bus time of one. Lanes are numbered in the
+// order of the pins given to begin(); a lane mask selects some of them
+// (bit n = lane n). Slot timings come from OneWire::timing.
+//
+// Per-lane buffers are laid out with a stride: lane n's bytes start at
+// buf + n * stride, which lets a read land directly in an array of structs.
+//
+// Lines are only pulled low or released - never driven high - so every
+// pin needs an external pullup (4.7k to VCC).
+
+#if defined(__AVR__)
+
+#define ONEWIRE_PORT_LANES 8
+
+class OneWirePort
+{
+  public:
+    OneWirePort() : lanes(0) { }
+    OneWirePort(const uint8_t *pins, uint8_t count) { begin(pins, count); }
+
+    // A pin not on the first pin's port keeps its lane number but never
+    // answers; returns the usable lanes
+    uint8_t begin(const uint8_t *pins, uint8_t count);
+    uint8_t count() const { return lanes; }
+
+    // Lanes that answered with a presence pulse. A lane still held low
+    // before the reset (short, or a chip mid-slot) does not count.
+    uint8_t reset(uint8_t lane_mask);
+
+    // stride 0 writes the same count bytes to every lane
+    void write_bytes(const uint8_t *buf, uint16_t count, uint8_t lane_mask, uint16_t stride = 0);
+    void read_bytes(uint8_t *buf, uint16_t count, uint8_t lane_mask, uint16_t stride);
+
+  private:
+    volatile uint8_t *baseReg;  // PIN register; DDR and PORT follow it
+    uint8_t bit[ONEWIRE_PORT_LANES];
+    uint8_t lanes;
+
+    uint8_t port_mask(uint8_t lane_mask) const;
+    uint8_t to_lanes(uint8_t port_bits, uint8_t lane_mask) const;
+};
+
+#endif // __AVR__
+
+#endif // __cplusplus
+#endif // OneWirePort_h
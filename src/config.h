@@ -11,6 +11,17 @@
 #define ONEWIRE_PIN 6
 #define ENABLE_PIN 8
 
+// Battery rack, read in parallel next to the single pack (0 = no rack).
+// The data lines must share one port (A0-A5 are PORTC on the Nano); each
+// slot has its own enable line. Slot n uses the n-th pin of each list.
+// The rack driver only pulls the data lines low and releases them, so each
+// one needs its own 4.7k pullup to 5V, as on pin 6.
+#ifndef RACK_SLOTS
+#define RACK_SLOTS 0
+#endif
+#define RACK_DATA_PINS   { A0, A1, A2, A3, A4, A5 }
+#define RACK_ENABLE_PINS { 2, 3, 4, 5, 7, 9 }
+
 // Utility macro
 #define SWAP_NIBBLES(x) ((x & 0x0F) << 4 | (x & 0xF0) >> 4)
 
@@ -19,14 +30,36 @@
 #define SHARED_BUF_SIZE 64
 extern byte g_buf[SHARED_BUF_SIZE];
 
+// Temperature not available
+#define TEMP_NONE ((int16_t)0x8000)
+
+// Decoded voltages and temperatures - integer units, formatted at output
+struct Telemetry {
+  uint16_t cell_mv[10];  // 5 or 10 cells
+  uint16_t diff_mv;      // Highest - lowest cell
+  uint16_t pack_mv;      // Sum of cells
+  int16_t t_cell;        // 0.1 C, TEMP_NONE if not available
+  int16_t t_mosfet;      // 0.1 C, TEMP_NONE if not available
+  uint8_t cell_count;    // 5 or 10, 0 = no voltage data
+};
+
+// Controller families (bit masks, also used by the command table)
+#define CHIP_UNKNOWN 0x00
+#define CHIP_STD     0x01  // Standard 18V, 0xD7 data block
+#define CHIP_F0513   0x02  // Older 18V F0513, one command per cell
+#define CHIP_BL36    0x04  // 40V, 10 cells
+#define CHIP_ALL     (CHIP_STD | CHIP_F0513 | CHIP_BL36)
+
 // Cached battery data - read once, use everywhere
 struct BatteryData {
   byte rom[8];           // ROM ID
   byte msg[32];          // MSG data from charger command
-  float voltages[9];     // [0-4]=cells, [5]=diff, [6]=pack, [7]=t_cell, [8]=t_mosfet
+  Telemetry tm;          // Voltages and temperatures
   bool valid;            // Data successfully read
-  bool is_bl36;          // 40V battery (10 cells)
-  uint8_t cell_count;    // 5 or 10
+  uint8_t chip;          // CHIP_*, CHIP_UNKNOWN if no voltages answered
+  uint8_t bus_status;    // BUS_* class of the last failed ROM/MSG read attempt
+  uint16_t bus_resets;   // Bus resets the last read took
+  uint32_t read_ms;      // Duration of the last read
 };
 extern BatteryData g_battery;
 
@@ -42,8 +75,7 @@ inline void printHexArray(const byte* arr, uint8_t len) {
   }
 }
 
-// External OneWire instance (defined in makita_comm.cpp)
-#include <OneWire2.h>
-extern OneWire makita;
+// Bus and enable pin access (OneWire on the board, simulator on native)
+#include "makita_hal.h"
 
 #endif
@@ -8,13 +8,26 @@
  *   - Pin 6 (ONEWIRE_PIN): Data line to battery (with 4.7k pullup to 5V)
  *   - Pin 8 (ENABLE_PIN): Enable/power control
  *   - GND: Battery ground
+ *   - Rack builds: A0-A5 data lines (each with its own 4.7k pullup to 5V),
+ *     D2, D3, D4, D5, D7, D9 enable lines, in slot order
  */
 
 #include "config.h"
+#include "makita_bench.h"
+#include "makita_chip.h"
 #include "makita_comm.h"
 #include "makita_commands.h"
 #include "makita_data.h"
+#include "makita_fleet.h"
+#include "makita_host.h"
+#include "makita_jobs.h"
 #include "makita_print.h"
+#include "makita_rack.h"
+#include "makita_report.h"
+#include "makita_stats.h"
+#include "makita_stream.h"
+#include "makita_task.h"
+#include "makita_timing.h"
 #include "makita_unlock.h"
 
 // ============== High-level functions ==============
@@ -23,32 +36,71 @@ void readAndPrintAll() {
   // Read all data first with warm-up
   if (!readAllBatteryData()) {
     Serial.println(F("ERROR: Failed to read battery data"));
+    printBusStatus(g_battery.bus_status);
     Serial.println(F("Check connection and try again."));
     printMenu();
     return;
   }
 
-  printHeader();
-  Serial.println();
-  printModel();
-  Serial.println();
-  printBatteryInfo();
-  Serial.println();
-  printVoltages();
-  Serial.println();
-  printDiagnosis();
-  Serial.println();
+  printReport();
+  if (reportFormat() == REPORT_TEXT) {
+    Serial.println();
+    printDiagnosis();
+    Serial.println();
+    printReadStats();
+  }
   printMenu();
 }
 
+// Background unlock started from the menu
+static Task unlock_task;
+
+// 'x' - a stream stops with its summary, anything else is cancelled
+static void cancelRunning() {
+  if (streamActive()) streamStop();
+  else if (fleetActive()) fleetStop();
+#if RACK_SLOTS
+  else if (rackJobsActive()) rackJobsStop();
+#endif
+  else taskCancel();
+}
+
+// Idle hook for blocking waits - 'x' cancels the running operation
+static void checkCancelKey() {
+  if (Serial.peek() == 'x' || Serial.peek() == 'X') {
+    Serial.read();
+    cancelRunning();
+  }
+}
+
+// Bus idle hook - runs while a transfer is clocked out in the background.
+// It serves the cancel key, and host frames while a task runs: the host
+// then only answers commands that leave the bus alone. Tasks are not
+// stepped here - each of them talks to a bus, and one started in the
+// middle of a transfer would collide with it.
+static void serveDuringTransfer() {
+  static bool inside = false;
+
+  if (inside || !Serial.available()) return;
+  inside = true;
+  if ((byte)Serial.peek() != HOST_SOF) {
+    checkCancelKey();
+  } else if (taskBusy()) {
+    Serial.read();
+    hostHandleFrame();
+  }
+  inside = false;
+}
+
 // ============== Setup ==============
 
 void setup() {
-  Serial.begin(9600);
+  Serial.begin(HOST_BAUD_DEFAULT);
 
-  pinMode(ONEWIRE_PIN, INPUT);
-  pinMode(ENABLE_PIN, OUTPUT);
-  digitalWrite(ENABLE_PIN, HIGH);
+  hal_init();
+  chip_init();
+  taskSetIdleHook(checkCancelKey);
+  set_bus_idle_hook(serveDuringTransfer);
 
   delay(1000);
 
@@ -64,12 +116,38 @@ void setup() {
 // ============== Main loop ==============
 
 void loop() {
+  uint8_t ended = taskRun();
+  if (ended == TASK_CANCELLED) {
+    set_enablepin(true);
+    Serial.println(F("\nCancelled."));
+  }
+  if (ended != TASK_WAITING) printMenu();
+
+  // Sleep until the next interrupt - a byte, a line edge or the millis() tick
+  hal_idle();
+
   if (Serial.available() > 0) {
     char cmd = Serial.read();
 
+    // Binary host frame - rest of the frame is still in the RX buffer
+    if ((byte)cmd == HOST_SOF) {
+      hostHandleFrame();
+      return;
+    }
+
     // Clear remaining characters
     while (Serial.available() > 0) Serial.read();
 
+    // Only cancel is accepted while a background operation runs
+    if (taskBusy()) {
+      if (cmd == 'x' || cmd == 'X') {
+        cancelRunning();
+      } else if (cmd != '\n' && cmd != '\r') {
+        Serial.println(F("\nBusy - press 'x' to cancel"));
+      }
+      return;
+    }
+
     switch (cmd) {
       case '1':
       case 'r':
@@ -88,18 +166,19 @@ void loop() {
       case '3':
       case 'u':
       case 'U':
-        unlockBattery();
-        printMenu();
+        taskStart(&unlock_task, unlockBatteryTask, NULL);
         break;
 
       case '4':
         Serial.println(F("\nTurning LEDs ON..."));
-        if (is_f0513()) {
+        if (chip_detect() == CHIP_F0513) {
           Serial.println(F("ERROR: F0513 chip - LED control not supported"));
         } else {
-          testmode_cmd();
-          delay(100);
-          makita.reset();
+          if (!bus_testmode()) {
+            testmode_cmd();
+            delay(100);
+          }
+          hal_reset();
           delay(50);
           leds_on_cmd();
           Serial.println(F("Done."));
@@ -109,12 +188,14 @@ void loop() {
 
       case '5':
         Serial.println(F("\nTurning LEDs OFF..."));
-        if (is_f0513()) {
+        if (chip_detect() == CHIP_F0513) {
           Serial.println(F("ERROR: F0513 chip - LED control not supported"));
         } else {
-          testmode_cmd();
-          delay(100);
-          makita.reset();
+          if (!bus_testmode()) {
+            testmode_cmd();
+            delay(100);
+          }
+          hal_reset();
           delay(50);
           leds_off_cmd();
           Serial.println(F("Done."));
@@ -162,6 +243,64 @@ void loop() {
         printMenu();
         break;
 
+      case 'b':
+      case 'B':
+        Serial.println();
+        benchOneWire();
+        printMenu();
+        break;
+
+      case 'm':
+      case 'M':
+        streamMenu();
+        if (!streamActive()) printMenu();
+        break;
+
+      case 't':
+      case 'T':
+        Serial.println();
+        calibrateTiming();
+        printMenu();
+        break;
+
+      case 'c':
+      case 'C':
+        Serial.println();
+        printStats();
+        printMenu();
+        break;
+
+      case 'z':
+      case 'Z':
+        stats_reset();
+        Serial.println(F("\nStatistics reset"));
+        break;
+
+      case 'f':
+      case 'F':
+        fleetStart();
+        break;
+
+#if RACK_SLOTS
+      case 'k':
+      case 'K':
+        Serial.println(F("\nReading battery rack..."));
+        rackRead();
+        printRack();
+        break;
+
+      case 'j':
+      case 'J':
+        Serial.println();
+        rackJobsMenu();
+        break;
+#endif
+
+      case 'o':
+      case 'O':
+        reportNextFormat();
+        break;
+
       case 'h':
       case 'H':
       case '?':
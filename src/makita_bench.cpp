@@ -0,0 +1,85 @@
+/*
+ * Makita Battery Reader - Bus Benchmarks
+ */
+
+#include "makita_bench.h"
+#include "makita_comm.h"
+#include "makita_print.h"
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define CYCLES_PER_US (F_CPU / 1000000UL)
+
+static void printBenchLine(const __FlashStringHelper* label, uint32_t us, uint32_t busy_cycles) {
+  uint32_t total = us * CYCLES_PER_US;
+  uint32_t free_pct = (total > busy_cycles) ? (total - busy_cycles) * 100 / total : 0;
+
+  Serial.print(label);
+  Serial.print(us);
+  Serial.print(F(" us, "));
+  Serial.print(total);
+  Serial.print(F(" cycles, CPU busy "));
+  Serial.print(busy_cycles);
+  Serial.print(F(" (free "));
+  Serial.print(free_pct);
+  Serial.println(F("%)"));
+}
+
+// charger_33 transaction: reset, 0x33, ROM[8], 0xF0 0x00, MSG[32]
+void benchOneWire() {
+  byte rom_cmd = 0x33;
+  byte cmd[2] = { 0xF0, 0x00 };
+  uint32_t t0, blocking_us, async_us;
+  uint32_t idle_loops = 0;
+  uint32_t hook_runs = 0;
+
+  printSeparator();
+  Serial.println(F("  ONEWIRE BENCHMARK (charger_33)"));
+  printSeparator();
+  Serial.flush();  // Keep UART interrupts out of the measurement
+
+  // Blocking driver - the CPU spins for the whole transfer
+  t0 = micros();
+  bool ok = hal_reset();
+  if (ok) {
+    delayMicroseconds(310);
+    hal_write(rom_cmd);
+    hal_read_bytes(g_buf, 8);
+    hal_write_bytes(cmd, 2);
+    hal_read_bytes(g_buf + 8, 32);
+  }
+  blocking_us = micros() - t0;
+
+  if (!ok) {
+    Serial.println(F("ERROR: No presence pulse"));
+    return;
+  }
+
+  delay(50);
+
+  // Background engine - count idle loops, each running the bus idle hook
+  HalSegment segs[4] = {
+    { &rom_cmd, 1, 0 },
+    { g_buf, 8, 1 },
+    { cmd, 2, 0 },
+    { g_buf + 8, 32, 1 },
+  };
+  t0 = micros();
+  hal_transfer_start(segs, 4, 310);
+  while (hal_transfer_busy()) {
+    idle_loops++;
+    hook_runs += bus_idle();
+  }
+  async_us = micros() - t0;
+  g_bus.last_family = 0x33;
+
+  printBenchLine(F("Blocking: "), blocking_us, blocking_us * CYCLES_PER_US);
+  printBenchLine(F("Async:    "), async_us, hal_transfer_cpu_cycles());
+  Serial.print(F("Idle loops during async: "));
+  Serial.println(idle_loops);
+  Serial.print(F("Idle hook runs (serial, cancel key): "));
+  Serial.println(hook_runs);
+  Serial.println(hal_transfer_status() == HAL_OK ? F("Async status: OK") : F("Async status: FAILED"));
+}
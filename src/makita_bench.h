@@ -0,0 +1,13 @@
+/*
+ * Makita Battery Reader - Bus Benchmarks
+ */
+
+#ifndef MAKITA_BENCH_H
+#define MAKITA_BENCH_H
+
+#include "config.h"
+
+// Blocking driver vs Timer1 engine on a charger_33 transaction
+void benchOneWire();
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Makita Battery Reader - Chip Family Drivers
+ */
+
+#include "makita_chip.h"
+#include "makita_comm.h"
+#include "makita_commands.h"
+#include "makita_data.h"
+#include "makita_profile.h"
+
+static uint8_t chip = CHIP_UNKNOWN;
+static uint8_t caps = 0;
+static byte chip_rom[8];
+
+// ============== Drivers ==============
+
+static bool std_model(char* model) {
+  byte data[10];
+  if (!model_cmd(data) || data[0] != 'B' || data[1] != 'L') return false;
+  memcpy(model, data, 6);
+  model[6] = '\0';
+  return true;
+}
+
+static bool f0513_model(char* model) {
+  byte data[2];
+  f0513_model_cmd(data);
+  if (data[0] == 0xFF && data[1] == 0xFF) return false;
+  sprintf(model, "BL%02X%02X", data[1], data[0]);
+  return true;
+}
+
+bool chip_telemetry(Telemetry* tm) {
+  switch (chip) {
+    case CHIP_STD:   return get_voltage_info(tm);
+    case CHIP_F0513: return f0513_voltages(tm);
+    case CHIP_BL36:  return bl36_voltages(tm);
+  }
+  return false;
+}
+
+bool chip_model(char* model) {
+  switch (chip) {
+    case CHIP_STD:
+    case CHIP_BL36:  return std_model(model);
+    case CHIP_F0513: return f0513_model(model);
+  }
+  return false;
+}
+
+// ============== Probe ==============
+
+// Wake latency measured since the profile was stored
+static void update_wake(PackProfile* p) {
+  if (!p->wake_ms && g_bus.wake_ms) {
+    p->wake_ms = g_bus.wake_ms;
+    profile_save(p);
+  }
+  bus_set_wake_hint(p->wake_ms);
+}
+
+uint8_t chip_probe(const byte* rom, Telemetry* tm) {
+  PackProfile p;
+
+  if (chip != CHIP_UNKNOWN && memcmp(rom, chip_rom, 8) == 0) {
+    if (!chip_telemetry(tm)) tm->cell_count = 0;
+    return chip;
+  }
+
+  // Known pack - straight to its driver
+  if (profile_load(rom, &p) && p.chip != CHIP_UNKNOWN) {
+    chip = p.chip;
+    caps = p.caps;
+    memcpy(chip_rom, rom, 8);
+    update_wake(&p);
+    if (chip_telemetry(tm)) return chip;
+    // No answer - probe again below in case the profile is stale
+  }
+
+  // Unknown while probing - the command table lets everything through
+  chip = CHIP_UNKNOWN;
+  caps = 0;
+
+  // A chip left mute by a foreign command needs a power cycle before the next try
+  if (get_voltage_info(tm)) chip = CHIP_STD;
+  if (!chip) {
+    trigger_power();
+    if (f0513_voltages(tm)) chip = CHIP_F0513;
+  }
+  if (!chip) {
+    trigger_power();
+    if (bl36_voltages(tm)) chip = CHIP_BL36;
+  }
+  if (!chip) {
+    tm->cell_count = 0;
+    return CHIP_UNKNOWN;  // Probe again next time
+  }
+
+  if (has_health()) caps |= CHIP_CAP_HEALTH;
+  memcpy(chip_rom, rom, 8);
+
+  p.chip = chip;
+  p.caps = caps;
+  if (g_bus.wake_ms) p.wake_ms = g_bus.wake_ms;
+  profile_save(&p);
+  bus_set_wake_hint(p.wake_ms);
+  return chip;
+}
+
+void chip_init() {
+  PackProfile p;
+  if (profile_last(&p)) bus_set_wake_hint(p.wake_ms);
+}
+
+uint8_t chip_family() {
+  return chip;
+}
+
+bool chip_has_health() {
+  return caps & CHIP_CAP_HEALTH;
+}
+
+uint8_t chip_detect() {
+  if (chip == CHIP_UNKNOWN) readAllBatteryData();
+  return chip;
+}
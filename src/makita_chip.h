@@ -0,0 +1,38 @@
+/*
+ * Makita Battery Reader - Chip Family Drivers
+ *
+ * Packs use one of three controller families with different command sets.
+ * The family is probed once per ROM ID, as part of the first voltage read,
+ * and kept in the pack's profile. Later reads of the same pack, also after
+ * a reconnect, go straight to its driver instead of trying each family in
+ * turn.
+ */
+
+#ifndef MAKITA_CHIP_H
+#define MAKITA_CHIP_H
+
+#include "config.h"
+
+// Capabilities found by the probe
+#define CHIP_CAP_HEALTH 0x01  // BMS health and counters (0xD4 status reads)
+
+// Warm-up hint from the pack seen last
+void chip_init();
+
+// Probe the family of the pack with this ROM, or reuse the cached result.
+// Fills the telemetry in the same pass (cell_count 0 if nothing answered).
+uint8_t chip_probe(const byte* rom, Telemetry* tm);
+
+// Family of the last probed pack, CHIP_UNKNOWN before the first read
+uint8_t chip_family();
+
+// Family of the connected pack, reading it first if nothing is cached
+uint8_t chip_detect();
+
+bool chip_has_health();
+
+// Driver dispatch
+bool chip_telemetry(Telemetry* tm);
+bool chip_model(char* model);  // "BLxxxx", 7 bytes with terminator
+
+#endif
@@ -3,9 +3,8 @@
  */
 
 #include "makita_comm.h"
-
-// Global OneWire instance
-OneWire makita(ONEWIRE_PIN);
+#include "makita_stats.h"
+#include "makita_timing.h"
 
 // Shared buffer - saves ~200 bytes RAM vs local arrays
 byte g_buf[SHARED_BUF_SIZE];
@@ -13,50 +12,237 @@ byte g_buf[SHARED_BUF_SIZE];
 // Global cached battery data
 BatteryData g_battery;
 
+// Bus session state
+BusSession g_bus;
+
+static void (*bus_idle_hook)() = 0;
+static uint16_t wake_hint = 0;
+
+void bus_forget() {
+  g_bus.awake = false;
+  g_bus.last_family = 0;
+  g_bus.testmode = false;
+  g_bus.rom_valid = false;
+}
+
 void set_enablepin(bool high) {
-  digitalWrite(ENABLE_PIN, high ? HIGH : LOW);
+  static bool powered = true;  // hal_init() switches the pack on
+
+  hal_set_enable(high);
+
+  // Power removed - the chip forgets test mode and the 0x33 quirk
+  if (!high) {
+    if (powered) g_stats.power_cycles++;
+    bus_forget();
+  }
+  powered = high;
 }
 
-void trigger_power() {
+bool bus_awake() {
+  return g_bus.awake && millis() - g_bus.last_ok < BUS_AWAKE_MS;
+}
+
+bool bus_testmode() {
+  return bus_awake() && g_bus.testmode;
+}
+
+void bus_ensure_awake() {
+  if (!bus_awake()) warmup_battery();
+}
+
+void bus_set_wake_hint(uint16_t ms) {
+  wake_hint = ms;
+}
+
+uint8_t trigger_power_task(Task* t) {
+  TASK_BEGIN(t);
   set_enablepin(false);
-  delay(200);
+  TASK_SLEEP(t, TRIGGER_POWER_OFF_MS);
   set_enablepin(true);
-  delay(500);
+  TASK_SLEEP(t, TRIGGER_POWER_MS - TRIGGER_POWER_OFF_MS);
+  TASK_END(t);
 }
 
-bool cmd_and_read(uint8_t initial, uint8_t *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len) {
-  int offset = (initial == 0x33 ? 8 : 0);
-  memset(rsp, 0xff, rsp_len + offset);
+void trigger_power() {
+  taskWait(trigger_power_task, NULL);
+  set_enablepin(true);  // Also after a cancel
+}
 
-  for (int i = 0; !makita.reset(); i++) {
-    if (i == 5) {
-      trigger_power();
-      return false;
-    }
-    delay(500);
+void set_bus_idle_hook(void (*hook)()) {
+  bus_idle_hook = hook;
+}
+
+bool bus_idle() {
+  if (!bus_idle_hook) return false;
+  bus_idle_hook();
+  return true;
+}
+
+// Reset + 310us gap + segments. The bus is clocked in the background;
+// the idle hook gets the CPU until the transfer completes. Returns HAL_*.
+static uint8_t bus_transfer(const HalSegment* segs, uint8_t count) {
+  if (!hal_transfer_start(segs, count, 310)) return HAL_BUSY;
+  while (hal_transfer_busy()) bus_idle();
+  return hal_transfer_status();
+}
+
+// The first 0xCC command after a 0x33 one fails - spend it on a short read
+static void absorb_cc_quirk() {
+  byte initial = 0xCC;
+  byte cmd[] = { 0xD7, 0x0E, 0x00, 0x02 };
+  byte dummy[2];
+  HalSegment segs[3] = {
+    { &initial, 1, 0 },
+    { cmd, 4, 0 },
+    { dummy, 2, 1 },
+  };
+
+  bus_transfer(segs, 3);
+  g_bus.last_family = 0xCC;
+}
+
+// Bare ROM read, no retries or power cycling - answers once the chip is up
+bool bus_poll_rom() {
+  byte initial = 0x33;
+  byte rom[8];
+  HalSegment segs[3] = {
+    { &initial, 1, 0 },
+    { rom, 3, HAL_SEG_PROBE },
+    { rom + 3, 5, 1 },
+  };
+
+  bool ok = bus_transfer(segs, 3) == HAL_OK;
+  g_bus.last_family = 0x33;
+  return ok;
+}
+
+bool bus_keep_alive() {
+  if (!bus_awake() || !bus_poll_rom()) return false;
+  g_bus.last_ok = millis();
+  return true;
+}
+
+// ============== Classified retries ==============
+
+struct RetryClass {
+  uint8_t backoff_ms;   // First wait, doubled per consecutive failure
+  uint8_t cycle_after;  // Consecutive failures before a power cycle
+};
+
+// Indexed by BUS_* status
+static const RetryClass retry_class[] PROGMEM = {
+  /* BUS_OK */          { 0, 0 },
+  /* BUS_NO_PRESENCE */ { 20, 3 },  // Asleep or not there - give it time first
+  /* BUS_GARBAGE */     { 10, 3 },  // Noise - retry quickly at default timing
+  /* BUS_NO_ANSWER */   { 50, 1 },  // Present but mute - only a power cycle helps
+};
+
+// ROM stage stuck low, or a different ROM than moments ago
+static bool rom_garbled(const byte* rom) {
+  bool zero = true;
+  for (uint8_t i = 0; i < 8; i++) {
+    if (rom[i]) zero = false;
   }
+  return zero || (g_bus.rom_valid && bus_awake() && memcmp(rom, g_bus.rom, 8) != 0);
+}
+
+uint8_t bus_attempt(uint8_t initial, uint8_t *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len) {
+  uint8_t offset = (initial == 0x33 ? 8 : 0);
+  uint8_t probe = (rsp_len >= BUS_PROBE_LEN ? BUS_PROBE_LEN : 0);
+  uint8_t status;
+  memset(rsp, 0xff, rsp_len + offset);
+
+  if (initial == 0xCC && g_bus.last_family == 0x33) absorb_cc_quirk();
+
+  // 0x33 command - read ROM ID first, then send command, then read response
+  // 0xCC command - skip ROM, send command (ROM segments are empty)
+  // The first bytes of the ROM and of the response are probes: a chip that
+  // does not answer reads as FF FF FF, and the transfer stops right there
+  HalSegment segs[6] = {
+    { &initial, 1, 0 },
+    { rsp, (uint8_t)(offset ? BUS_PROBE_LEN : 0), HAL_SEG_PROBE },
+    { rsp + BUS_PROBE_LEN, (uint8_t)(offset ? offset - BUS_PROBE_LEN : 0), 1 },
+    { cmd, cmd_len, 0 },
+    { rsp + offset, probe, HAL_SEG_PROBE },
+    { rsp + offset + probe, (uint8_t)(rsp_len - probe), 1 },
+  };
+
+  // After a failure the chip may not have seen the quirk absorbed - assume it is armed
+  g_bus.last_family = 0x33;
 
-  delayMicroseconds(310);
+  status = bus_transfer(segs, 6);
+  if (status == HAL_NO_ANSWER) {
+    g_stats.no_answer++;
+    return BUS_NO_ANSWER;
+  }
+  if (status != HAL_OK) {
+    g_stats.presence_fail++;
+    return BUS_NO_PRESENCE;
+  }
+  if (offset && rom_garbled(rsp)) {
+    g_stats.garbage++;
+    return BUS_GARBAGE;
+  }
 
+  g_bus.awake = true;
+  g_bus.last_family = initial;
+  g_bus.last_ok = millis();
   if (offset) {
-    // 0x33 command - read ROM ID first, then send command, then read response
-    makita.write(initial);
-    makita.read_bytes(rsp, offset);
-    makita.write_bytes(cmd, cmd_len);
-  } else {
-    // 0xCC command - skip ROM, send command
-    makita.write(initial);
-    makita.write_bytes(cmd, cmd_len);
+    memcpy(g_bus.rom, rsp, 8);
+    g_bus.rom_valid = true;
   }
+  return BUS_OK;
+}
+
+uint8_t bus_command(uint8_t initial, uint8_t *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len,
+                    uint8_t tries, uint16_t budget_ms, BusResult* res) {
+  uint32_t t0 = millis();
+  uint8_t streak = 0;
+  RetryClass rc;
+
+  memset(res, 0, sizeof(*res));
+
+  for (;;) {
+    uint8_t st = bus_attempt(initial, cmd, cmd_len, rsp, rsp_len);
+    res->attempts++;
+    if (st == BUS_OK) {
+      res->status = BUS_OK;
+      break;
+    }
+
+    timing_fallback();
+    streak = (st == res->last) ? streak + 1 : 1;
+    res->last = st;
+    res->status = st;
+    if (res->attempts >= tries) break;
 
-  makita.read_bytes(rsp + offset, rsp_len);
+    // Escalate, but only if the budget still covers it
+    memcpy_P(&rc, &retry_class[st], sizeof(rc));
+    uint32_t wait = (streak >= rc.cycle_after) ? TRIGGER_POWER_MS
+                                               : (uint32_t)rc.backoff_ms << (streak < 4 ? streak - 1 : 3);
+    if (millis() - t0 + wait > budget_ms) {
+      res->status = BUS_TIMEOUT;
+      break;
+    }
 
-  if (rsp_len < 3 || !(rsp[offset] == 0xFF && rsp[1 + offset] == 0xFF && rsp[2 + offset] == 0xff)) {
-    return true;
-  } else {
-    trigger_power();
-    return false;
+    if (streak >= rc.cycle_after) {
+      trigger_power();
+      res->power_cycles++;
+      streak = 0;
+    } else {
+      delay(wait);
+    }
   }
+
+  res->ms = millis() - t0;
+  return res->status;
+}
+
+// Single attempt - callers that need retries use bus_command()
+bool cmd_and_read(uint8_t initial, uint8_t *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len) {
+  if (bus_attempt(initial, cmd, cmd_len, rsp, rsp_len) == BUS_OK) return true;
+  timing_fallback();
+  return false;
 }
 
 bool cmd_and_read_33(uint8_t *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len) {
@@ -67,26 +253,53 @@ bool cmd_and_read_cc(uint8_t *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len)
   return cmd_and_read(0xcc, cmd, cmd_len, rsp, rsp_len);
 }
 
-// Warm-up sequence - stabilizes communication before real reads
-void warmup_battery() {
+// Warm-up sequence - stabilizes communication before real reads. Written
+// as a task so streams and scans can wait for it without blocking;
+// warmup_battery() runs it to completion.
+static uint16_t wake_hint_used;  // Hint when the warm-up started
+static uint32_t wake_t0;
+static bool wake_up;
+
+uint8_t bus_wake_task(Task* t) {
+  byte cmd[] = { 0xD7, 0x0E, 0x00, 0x02 };
   byte dummy[16];
+  uint32_t elapsed;
 
-  // Trigger power cycle to wake battery
-  trigger_power();
-  delay(200);
+  TASK_BEGIN(t);
+  wake_hint_used = wake_hint;
 
-  // Do several dummy reads to stabilize
-  for (int i = 0; i < 3; i++) {
-    makita.reset();
-    delay(100);
+  // Power cycle to wake the battery
+  set_enablepin(false);
+  TASK_SLEEP(t, 200);
+  set_enablepin(true);
+  wake_t0 = millis();
+
+  if (wake_hint_used) TASK_SLEEP(t, wake_hint_used + WAKE_MARGIN_MS);
+  while (!(wake_up = bus_poll_rom()) && millis() - wake_t0 < WAKE_TIMEOUT_MS) {
+    TASK_SLEEP(t, WAKE_POLL_MS);
+  }
+  if (!wake_hint_used) {
+    elapsed = millis() - wake_t0;
+    g_bus.wake_ms = wake_up ? elapsed : 0;
+    if (elapsed < WAKE_SETTLE_MS) TASK_SLEEP(t, WAKE_SETTLE_MS - elapsed);
+  }
+
+  // Do dummy reads to stabilize - one is enough for a pack that answered in time
+  for (t->i = 0; t->i < (wake_hint_used && wake_up ? 1 : 3); t->i++) {
+    hal_reset();
+    TASK_SLEEP(t, 100);
 
     // Dummy temperature read (lightweight command)
-    byte cmd[] = { 0xD7, 0x0E, 0x00, 0x02 };
     cmd_and_read_cc(cmd, 4, dummy, 3);
-    delay(50);
+    TASK_SLEEP(t, 50);
   }
 
   // Final reset before real operations
-  makita.reset();
-  delay(100);
+  hal_reset();
+  TASK_SLEEP(t, 100);
+  TASK_END(t);
+}
+
+void warmup_battery() {
+  if (taskWait(bus_wake_task, NULL) == TASK_CANCELLED) set_enablepin(true);
 }
@@ -6,17 +6,86 @@
 #define MAKITA_COMM_H
 
 #include "config.h"
+#include "makita_task.h"
+
+// Bus session - what the battery has seen since the last power cycle
+struct BusSession {
+  bool awake;            // Answered since the last power cycle
+  uint8_t last_family;   // Initial byte of the last transaction (0x33 / 0xCC), 0 = none
+  bool testmode;         // Test mode entered and not left
+  uint32_t last_ok;      // millis() of the last successful transaction
+  uint16_t wake_ms;      // Power-on to first answer, measured by a full warm-up (0 = not measured)
+  bool rom_valid;        // rom holds the ROM read since the last power cycle
+  byte rom[8];
+};
+extern BusSession g_bus;
+
+// Idle time after which the battery may be asleep again and needs a warm-up
+#define BUS_AWAKE_MS     2000
+#define BUS_KEEPALIVE_MS (BUS_AWAKE_MS / 2)  // ROM read that keeps an idle session
+
+// Warm-up polling
+#define WAKE_POLL_MS    20    // Between ROM reads while waiting for the chip
+#define WAKE_TIMEOUT_MS 1000  // Give up polling, continue with the fixed sequence
+#define WAKE_MARGIN_MS  50    // Added to a known pack's wake latency
+#define WAKE_SETTLE_MS  700   // Power-on to first settling read for an unknown pack
+
+bool bus_awake();
+bool bus_testmode();
+void bus_ensure_awake();  // Warm-up only when the battery may be asleep
+void bus_set_wake_hint(uint16_t ms);  // Wake latency of the expected pack, 0 = unknown
+bool bus_poll_rom();      // One bare ROM read: true once the chip answers
+bool bus_keep_alive();    // ROM read that extends an awake session; false if there is none
+void bus_forget();        // Pack gone or unpowered - the next command starts a new session
 
 // Power control
+#define TRIGGER_POWER_OFF_MS 200
+#define TRIGGER_POWER_MS     700  // Off plus time to come back up
+
 void set_enablepin(bool high);
 void trigger_power();
+uint8_t trigger_power_task(Task* t);
+
+// Called repeatedly while a transfer is clocked out in the background
+void set_bus_idle_hook(void (*hook)());
+bool bus_idle();  // Runs the hook once; false if none is installed
+
+// Transaction outcome
+#define BUS_OK          0
+#define BUS_NO_PRESENCE 1  // No presence pulse after reset
+#define BUS_GARBAGE     2  // ROM stage stuck low, or not the ROM read moments ago
+#define BUS_NO_ANSWER   3  // Present, but the ROM or response starts with 0xFF 0xFF 0xFF
+#define BUS_TIMEOUT     4  // Time budget spent; `last` holds the last failure
+#define BUS_UNSUPPORTED 5  // Not a command of this chip family, bus untouched
+
+#define BUS_PROBE_LEN   3  // Leading 0xFF bytes that end an attempt early
+
+struct BusResult {
+  uint8_t status;        // BUS_*
+  uint8_t last;          // Class of the last failed attempt
+  uint8_t attempts;
+  uint8_t power_cycles;
+  uint16_t ms;
+};
+
+// One classified transaction, no retries
+uint8_t bus_attempt(uint8_t initial, uint8_t *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len);
+
+// Up to `tries` attempts within budget_ms. Backoff doubles per consecutive
+// failure of the same class; repeated failures escalate to a power cycle.
+// Nothing is started that would end past the budget.
+uint8_t bus_command(uint8_t initial, uint8_t *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len,
+                    uint8_t tries, uint16_t budget_ms, BusResult* res);
 
-// Low-level OneWire commands
+// Low-level OneWire commands (single attempt)
 bool cmd_and_read(uint8_t initial, uint8_t *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len);
 bool cmd_and_read_33(uint8_t *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len);
 bool cmd_and_read_cc(uint8_t *cmd, uint8_t cmd_len, byte *rsp, uint8_t rsp_len);
 
-// Warm-up sequence for stable communication
+// Warm-up sequence for stable communication. Without a hint it measures
+// the wake latency and runs the full settling sequence; with one it waits
+// that long and settles with a single read.
 void warmup_battery();
+uint8_t bus_wake_task(Task* t);  // The same, for callers that must not block
 
 #endif
@@ -3,200 +3,271 @@
  */
 
 #include "makita_commands.h"
+#include "makita_chip.h"
 #include "makita_comm.h"
 #include "makita_data.h"
+#include "makita_stats.h"
+
+// ============== Command table ==============
+
+#define CMD_ARG 0x80  // Last opcode byte comes from the caller
+
+struct CmdDesc {
+  uint8_t initial;  // 0x33 (ROM read first), 0xCC, or a bare opcode
+  uint8_t op[4];
+  uint8_t op_len;
+  uint8_t rsp_len;  // After the ROM for 0x33 commands
+  uint8_t tries;
+  uint8_t budget;   // Time budget for all tries, 100 ms units
+  uint8_t flags;    // CHIP_* | CMD_ARG
+};
+
+// Test mode, DA and MSG commands are sent once, as before the table: the
+// unlock ladders time them, and a retry could end in a power cycle
+static const CmdDesc cmd_table[CMD_COUNT] PROGMEM = {
+  /* CMD_MODEL */         { 0xCC, { 0xDC, 0x0C },             2, 10, 10, 15, CHIP_STD | CHIP_BL36 },
+  /* CMD_CHARGER */       { 0x33, { 0xF0, 0x00 },             2, 32, 20, 30, CHIP_ALL },
+  /* CMD_MSG */           { 0x33, { 0xAA, 0x00 },             2, 40, 1,  10, CHIP_ALL },
+  /* CMD_DATA_BLOCK */    { 0xCC, { 0xD7, 0x00, 0x00, 0xFF }, 4, 29, 1,  10, CHIP_STD },
+  /* CMD_CELL_TEMP */     { 0xCC, { 0xD7, 0x0E, 0x00, 0x02 }, 4, 3,  3,  10, CHIP_STD },
+  /* CMD_MOSFET_TEMP */   { 0xCC, { 0xD7, 0x10, 0x00, 0x02 }, 4, 3,  3,  10, CHIP_STD },
+  /* CMD_TEMPS */         { 0xCC, { 0xD7, 0x0E, 0x00, 0x04 }, 4, 4,  3,  10, CHIP_STD },
+  /* CMD_STATUS_BA */     { 0xCC, { 0xD4, 0xBA, 0x00, 0x01 }, 4, 2,  3,  10, CHIP_ALL },
+  /* CMD_OVERLOAD */      { 0xCC, { 0xD4, 0x8D, 0x00, 0x07 }, 4, 8,  3,  10, CHIP_ALL },
+  /* CMD_HEALTH */        { 0xCC, { 0xD4, 0x50, 0x01, 0x02 }, 4, 3,  3,  10, CHIP_ALL },
+  /* CMD_TESTMODE */      { 0x33, { 0xD9, 0x96, 0xA5 },       3, 29, 1,  10, CHIP_ALL },
+  /* CMD_EXIT_TESTMODE */ { 0x33, { 0xD9, 0xFF, 0xFF },       3, 1,  1,  10, CHIP_ALL },
+  /* CMD_DA */            { 0x33, { 0xDA, 0x00 },             2, 9,  1,  10, CHIP_ALL | CMD_ARG },
+  /* CMD_F0513_TREE */    { 0xCC, { 0x99 },                   1, 0,  1,  10, CHIP_F0513 },
+  /* CMD_F0513_VCELL */   { 0xCC, { 0x31 },                   1, 2,  1,  10, CHIP_F0513 | CMD_ARG },
+  /* CMD_F0513_TEMP */    { 0xCC, { 0x52 },                   1, 2,  1,  10, CHIP_F0513 },
+  /* CMD_BL36_TESTMODE */ { 0xCC, { 0x10, 0x21 },             2, 0,  1,  10, CHIP_BL36 },
+  /* CMD_BL36_CELLS */    { 0xD4, { 0 },                      0, 20, 1,  10, CHIP_BL36 },
+};
+
+// Family of the probed pack; anything goes until it is known
+static uint8_t cached_families() {
+  uint8_t chip = chip_family();
+  return chip != CHIP_UNKNOWN ? chip : CHIP_ALL;
+}
+
+static bool cmd_run(uint8_t id, byte* rsp, byte arg, uint8_t tries, BusResult* res) {
+  BusResult local;
+  CmdDesc d;
+  uint32_t t0;
+
+  if (!res) res = &local;
+  memcpy_P(&d, &cmd_table[id], sizeof(d));
+
+  if (!(d.flags & cached_families())) {
+    memset(rsp, 0xff, d.rsp_len + (d.initial == 0x33 ? 8 : 0));
+    memset(res, 0, sizeof(*res));
+    res->status = res->last = BUS_UNSUPPORTED;
+    return false;
+  }
+  if (d.flags & CMD_ARG) d.op[d.op_len - 1] = arg;
+  if (!tries) tries = d.tries;
+
+  t0 = micros();
+  bus_command(d.initial, d.op, d.op_len, rsp, d.rsp_len, tries, d.budget * 100U, res);
+  stats_command(id, res->attempts, res->status, micros() - t0);
+  return res->status == BUS_OK;
+}
+
+uint8_t cmd_key(uint8_t id, byte* key) {
+  uint8_t len = pgm_read_byte(&cmd_table[id].op_len);
+
+  key[0] = pgm_read_byte(&cmd_table[id].initial);
+  for (uint8_t i = 0; i < CMD_KEY_LEN - 1; i++) {
+    key[1 + i] = i < len ? pgm_read_byte(&cmd_table[id].op[i]) : 0;
+  }
+  return len;
+}
+
+bool cmd_exec(uint8_t id, byte* rsp, byte arg, BusResult* res) {
+  return cmd_run(id, rsp, arg, 0, res);
+}
+
+bool cmd_once(uint8_t id, byte* rsp, byte arg, BusResult* res) {
+  return cmd_run(id, rsp, arg, 1, res);
+}
 
 // ============== F0513 chip commands ==============
 
 void f0513_second_command_tree() {
-  byte cmd[] = { 0x99 };
-  byte rsp[16];
-  memset(rsp, 0, 16);
-  cmd_and_read_cc(cmd, 1, rsp, 0);
-  makita.reset();
+  cmd_exec(CMD_F0513_TREE, g_buf);
+  hal_reset();
   delayMicroseconds(310);
 }
 
 void f0513_model_cmd(byte rsp[]) {
   f0513_second_command_tree();
-  makita.write(0x31);
+  hal_write(0x31);
   delayMicroseconds(90);
-  rsp[0] = makita.read();
+  rsp[0] = hal_read();
   delayMicroseconds(90);
-  rsp[1] = makita.read();
+  rsp[1] = hal_read();
 }
 
 void f0513_version_cmd(byte rsp[]) {
   f0513_second_command_tree();
-  makita.write(0x32);
+  hal_write(0x32);
   delayMicroseconds(90);
-  rsp[0] = makita.read();
+  rsp[0] = hal_read();
   delayMicroseconds(90);
-  rsp[1] = makita.read();
+  rsp[1] = hal_read();
 }
 
-void f0513_vcell_cmd(byte cmd_byte, byte rsp[]) {
-  byte cmd_params[] = { cmd_byte };
-  cmd_and_read_cc(cmd_params, 1, rsp, 2);
-}
+// ============== Control commands ==============
 
-void f0513_temp_cmd(byte rsp[]) {
-  byte cmd_params[] = { 0x52 };
-  cmd_and_read_cc(cmd_params, 1, rsp, 2);
+void testmode_cmd() {
+  if (cmd_exec(CMD_TESTMODE, g_buf)) g_bus.testmode = true;
 }
 
-bool is_f0513() {
-  byte data[32];
-  f0513_model_cmd(data);
-  return !(data[0] == 0xFF && data[1] == 0xFF);
+void exit_testmode_cmd() {
+  cmd_exec(CMD_EXIT_TESTMODE, g_buf);
+  g_bus.testmode = false;
 }
 
-// ============== Standard battery commands ==============
+// ============== EEPROM operations ==============
 
-bool model_cmd(byte rsp[]) {
-  byte cmd_params[] = { 0xDC, 0x0C };
-  for (int i = 0; i < 10; i++) {
-    if (cmd_and_read_cc(cmd_params, 2, rsp, 10)) return true;
-  }
-  return false;
-}
+static bool msg_write_ok;
+static bool msg_skipped;
+static bool msg_diff_known;   // msg_changed holds the diff against the pack
+static byte msg_changed[MSG_DIFF_BYTES];
 
-void read_data_request(byte rsp[]) {
-  byte cmd_params[] = { 0xD7, 0x00, 0x00, 0xFF };
-  cmd_and_read_cc(cmd_params, 4, rsp, 29);
-}
+uint8_t store_cmd_task(Task* t) {
+  byte rsp[8];
+  byte* data = (byte*)t->arg;
 
-bool charger_33_cmd(byte rsp[]) {
-  byte cmd_params[] = { 0xF0, 0x00 };
-  return cmd_and_read_33(cmd_params, 2, rsp, 32);
-}
+  TASK_BEGIN(t);
 
-bool try_charger(byte rsp[]) {
-  for (int i = 0; i < 20; i++) {
-    if (charger_33_cmd(rsp)) return true;
+  // Reset and prepare
+  for (t->i = 0; !hal_reset(); t->i++) {
+    if (t->i == 5) TASK_EXIT(t);
+    TASK_SLEEP(t, 100);
   }
-  return false;
-}
-
-// ============== Control commands ==============
+  delayMicroseconds(310);
 
-void testmode_cmd() {
-  byte cmd_params[] = { 0xD9, 0x96, 0xA5 };
-  cmd_and_read_33(cmd_params, 3, g_buf, 29);
-}
+  // Send ROM read command first
+  hal_write(0x33);
+  hal_read_bytes(rsp, 8);
+  g_bus.last_family = 0x33;
+
+  // Write command: 0x0F 0x00 + 32 bytes data (scratchpad, no wait needed)
+  hal_write(0x0F);
+  hal_write(0x00);
+  hal_write_bytes(data, 32);
+
+  // Commit scratchpad to EEPROM - once
+  for (t->i = 0; !hal_reset(); t->i++) {
+    if (t->i == 5) TASK_EXIT(t);
+    TASK_SLEEP(t, 100);
+  }
+  delayMicroseconds(310);
 
-void exit_testmode_cmd() {
-  byte cmd_params[] = { 0xD9, 0xFF, 0xFF };
-  cmd_and_read_33(cmd_params, 3, g_buf, 1);
-}
+  hal_write(0x33);
+  hal_read_bytes(rsp, 8);
 
-// Unified DA command - saves ~100 bytes Flash
-void send_da_cmd(byte sub_cmd) {
-  byte cmd_params[] = { 0xDA, sub_cmd };
-  cmd_and_read_33(cmd_params, 2, g_buf, 9);
-}
+  hal_write(0x55);
+  hal_write(0xA5);
 
-// ============== EEPROM operations ==============
+  // The chip does not answer while it programs - poll until it does
+  for (t->i = 0; t->i < COMMIT_TIMEOUT_MS / COMMIT_POLL_MS; t->i++) {
+    TASK_SLEEP(t, COMMIT_POLL_MS);
+    if (bus_poll_rom()) break;
+  }
 
-bool read_msg_cmd(byte rsp[]) {
-  byte cmd_params[] = { 0xAA, 0x00 };
-  return cmd_and_read_33(cmd_params, 2, rsp, 40);
+  TASK_END(t);
 }
 
 void store_cmd_direct(byte data[]) {
-  byte rsp[16];
+  taskWait(store_cmd_task, data);
+}
 
-  // Reset and prepare
-  for (int i = 0; !makita.reset(); i++) {
-    if (i == 5) return;
-    delay(100);
+// Combined EEPROM write sequence (raw - caller must ensure valid checksums).
+// Nothing is written if the pack already holds this MSG. Otherwise the MSG
+// is read back after every commit; only a mismatch writes again.
+uint8_t write_msg_task(Task* t) {
+  static Task child;
+
+  TASK_BEGIN(t);
+  msg_write_ok = false;
+  msg_skipped = false;
+  msg_diff_known = try_charger(g_buf);
+
+  if (msg_diff_known && !msgDiff(g_buf + 8, (const byte*)t->arg, msg_changed)) {
+    msg_write_ok = true;
+    msg_skipped = true;
+    TASK_EXIT(t);
   }
-  delayMicroseconds(310);
 
-  // Send ROM read command first
-  makita.write(0x33);
-  makita.read_bytes(rsp, 8);
+  for (t->j = 0; t->j < MSG_WRITE_TRIES; t->j++) {
+    testmode_cmd();
+    TASK_AWAIT(t, &child, store_cmd_task, t->arg);
+    exit_testmode_cmd();  // Exit testmode to commit changes!
 
-  // Write command: 0x0F 0x00 + 32 bytes data
-  makita.write(0x0F);
-  makita.write(0x00);
-  makita.write_bytes(data, 32);
-
-  delay(500);  // Wait for scratchpad write
-
-  // Commit to EEPROM - try multiple times
-  for (int retry = 0; retry < 3; retry++) {
-    for (int i = 0; !makita.reset(); i++) {
-      if (i == 5) break;
-      delay(100);
+    if (try_charger(g_buf) && memcmp(g_buf + 8, t->arg, 32) == 0) {
+      msg_write_ok = true;
+      TASK_EXIT(t);
     }
-    delayMicroseconds(310);
 
-    makita.write(0x33);
-    makita.read_bytes(rsp, 8);
+    // Start the next try from a freshly powered chip
+    TASK_AWAIT(t, &child, trigger_power_task, NULL);
+  }
+  TASK_END(t);
+}
 
-    makita.write(0x55);
-    makita.write(0xA5);
+bool msg_write_verified() {
+  return msg_write_ok;
+}
 
-    delay(500);  // EEPROM write time (10ms per byte * 32 = 320ms min)
-  }
+bool msg_write_skipped() {
+  return msg_skipped;
+}
+
+const byte* msg_write_changes() {
+  return msg_diff_known ? msg_changed : NULL;
 }
 
-// Combined EEPROM write sequence (raw - caller must ensure valid checksums)
-void write_msg_to_eeprom(byte* msg) {
-  testmode_cmd();
-  delay(100);
-  charger_33_cmd(g_buf);  // Dummy read
-  delay(100);
-  store_cmd_direct(msg);
-  delay(500);
-  exit_testmode_cmd();  // Exit testmode to commit changes!
-  delay(200);
-  trigger_power();
-  delay(300);
+bool write_msg_to_eeprom(byte* msg) {
+  if (taskWait(write_msg_task, msg) == TASK_CANCELLED) {
+    set_enablepin(true);
+    return false;
+  }
+  return msg_write_ok;
 }
 
 // Safe EEPROM write - recalculates all checksums before writing
-void write_msg_safe(byte* msg) {
+bool write_msg_safe(byte* msg) {
   recalcMsgChecksums(msg);
-  write_msg_to_eeprom(msg);
+  return write_msg_to_eeprom(msg);
 }
 
 // ============== BL36 (40V) commands ==============
 
-bool bl36_testmode() {
-  byte cmd[] = { 0x10, 0x21 };
-  return cmd_and_read_cc(cmd, 2, cmd, 0);
+// V = 5.5 - code / 11916, in mV and rounded
+static inline uint16_t code_to_mv(uint16_t raw16) {
+  static const uint16_t COUNTS_PER_VOLT = 11916;
+  static const uint16_t INTERCEPT_MV = 5500;
+  uint16_t drop = ((uint32_t)raw16 * 1000 + COUNTS_PER_VOLT / 2) / COUNTS_PER_VOLT;
+  return drop < INTERCEPT_MV ? INTERCEPT_MV - drop : 0;
 }
 
-static inline float code_to_voltage_u16(uint16_t raw16) {
-  static const float COUNTS_PER_VOLT = 11916;
-  static const float C_INTERCEPT = 5.5;
-  return C_INTERCEPT - (float)raw16 / COUNTS_PER_VOLT;
-}
+bool bl36_voltages(Telemetry* out) {
+  byte rsp[20];
 
-bool bl36_voltages(float voltages[]) {
-  byte rsp[64];
-  float max_v = -5;
-  float min_v = 5;
-  float vTotal = 0;
-
-  memset(rsp, 0, 64);
-
-  if (!(bl36_testmode() && cmd_and_read(0xd4, rsp, 0, rsp, 20))) {
+  if (!(bl36_testmode() && cmd_exec(CMD_BL36_CELLS, rsp))) {
     return false;
   }
 
+  out->cell_count = 10;
   for (int i = 0; i < 10; i++) {
-    voltages[i] = code_to_voltage_u16((int)rsp[i * 2] | ((int)rsp[i * 2 + 1]) << 8);
-    vTotal += voltages[i];
-    if (voltages[i] > max_v) max_v = voltages[i];
-    if (voltages[i] < min_v) min_v = voltages[i];
+    out->cell_mv[i] = code_to_mv((int)rsp[i * 2] | ((int)rsp[i * 2 + 1]) << 8);
   }
-
-  voltages[10] = max_v - min_v;
-  voltages[11] = vTotal;
-  voltages[12] = 0;
+  out->t_cell = TEMP_NONE;
+  out->t_mosfet = TEMP_NONE;
+  telemetry_totals(out);
 
   return true;
 }
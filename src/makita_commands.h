@@ -6,37 +6,77 @@
 #define MAKITA_COMMANDS_H
 
 #include "config.h"
+#include "makita_comm.h"
+#include "makita_task.h"
+
+// Command table entries (see cmd_table in makita_commands.cpp)
+#define CMD_MODEL          0   // DC 0C          -> model[10]
+#define CMD_CHARGER        1   // 33 F0 00       -> rom[8] msg[32]
+#define CMD_MSG            2   // 33 AA 00       -> rom[8] msg[40]
+#define CMD_DATA_BLOCK     3   // D7 00 00 FF    -> data block[29]
+#define CMD_CELL_TEMP      4   // D7 0E 00 02    -> raw[2] + 1
+#define CMD_MOSFET_TEMP    5   // D7 10 00 02    -> raw[2] + 1
+#define CMD_TEMPS          6   // D7 0E 00 04    -> cell[2] mosfet[2]
+#define CMD_STATUS_BA      7   // D4 BA 00 01    -> overdischarge, health format
+#define CMD_OVERLOAD       8   // D4 8D 00 07    -> counters[8]
+#define CMD_HEALTH         9   // D4 50 01 02    -> health[3]
+#define CMD_TESTMODE       10  // 33 D9 96 A5
+#define CMD_EXIT_TESTMODE  11  // 33 D9 FF FF
+#define CMD_DA             12  // 33 DA <arg>
+#define CMD_F0513_TREE     13  // 99 - switch to the second command tree
+#define CMD_F0513_VCELL    14  // <arg> = 0x31..0x35 -> cell[2]
+#define CMD_F0513_TEMP     15  // 52             -> temp[2]
+#define CMD_BL36_TESTMODE  16  // 10 21
+#define CMD_BL36_CELLS     17  // D4 (no ROM stage) -> cells[20]
+#define CMD_COUNT          18
+
+// Run a table command: the table's retries and time budget, or a single
+// attempt. arg replaces the last opcode byte of commands that take one.
+// Commands the cached pack doesn't support fail with BUS_UNSUPPORTED without
+// bus traffic. res, if given, receives the outcome.
+bool cmd_exec(uint8_t id, byte* rsp, byte arg = 0, BusResult* res = NULL);
+bool cmd_once(uint8_t id, byte* rsp, byte arg = 0, BusResult* res = NULL);
+#define CMD_KEY_LEN 5
+uint8_t cmd_key(uint8_t id, byte* key);  // Initial byte and the opcode (zero padded), returns op_len
 
 // F0513 chip commands (older batteries)
 void f0513_second_command_tree();
 void f0513_model_cmd(byte rsp[]);
 void f0513_version_cmd(byte rsp[]);
-void f0513_vcell_cmd(byte cmd_byte, byte rsp[]);
-void f0513_temp_cmd(byte rsp[]);
-bool is_f0513();
+inline void f0513_vcell_cmd(byte cmd_byte, byte rsp[]) { cmd_exec(CMD_F0513_VCELL, rsp, cmd_byte); }
+inline void f0513_temp_cmd(byte rsp[]) { cmd_exec(CMD_F0513_TEMP, rsp); }
 
 // Standard battery commands
-bool model_cmd(byte rsp[]);
-void read_data_request(byte rsp[]);
-bool charger_33_cmd(byte rsp[]);
-bool try_charger(byte rsp[]);
+inline bool model_cmd(byte rsp[]) { return cmd_exec(CMD_MODEL, rsp); }
+inline void read_data_request(byte rsp[]) { cmd_exec(CMD_DATA_BLOCK, rsp); }
+inline bool charger_33_cmd(byte rsp[]) { return cmd_once(CMD_CHARGER, rsp); }
+inline bool try_charger(byte rsp[]) { return cmd_exec(CMD_CHARGER, rsp); }
 
 // Control commands
 void testmode_cmd();
 void exit_testmode_cmd();  // Exit test mode - required after EEPROM write!
-void send_da_cmd(byte sub_cmd);  // Unified DA command
+inline void send_da_cmd(byte sub_cmd) { cmd_exec(CMD_DA, g_buf, sub_cmd); }
 inline void reset_error_cmd() { send_da_cmd(0x04); }
 inline void leds_on_cmd() { send_da_cmd(0x31); }
 inline void leds_off_cmd() { send_da_cmd(0x34); }
 
 // EEPROM operations
-bool read_msg_cmd(byte rsp[]);
+inline bool read_msg_cmd(byte rsp[]) { return cmd_exec(CMD_MSG, rsp); }
+#define MSG_WRITE_TRIES   3     // Commits per write, while the read-back differs
+#define COMMIT_POLL_MS    10    // ROM poll interval while the chip programs
+#define COMMIT_TIMEOUT_MS 1000  // Give up polling (read-back decides)
+
 void store_cmd_direct(byte data[]);
-void write_msg_to_eeprom(byte* msg);  // Raw write (caller ensures checksums)
-void write_msg_safe(byte* msg);       // Safe write (auto-recalculates checksums)
+bool write_msg_to_eeprom(byte* msg);  // Raw write (caller ensures checksums), true if read back
+uint8_t store_cmd_task(Task* t);      // arg = 32-byte MSG
+uint8_t write_msg_task(Task* t);      // arg = 32-byte MSG
+bool msg_write_verified();            // Read-back result of the last write_msg_task
+bool msg_write_skipped();             // Pack already held the MSG, nothing written
+const byte* msg_write_changes();      // Its nybble diff (msgDiff), NULL if the pack could not be read first
+bool write_msg_safe(byte* msg);       // Safe write (auto-recalculates checksums)
 
 // BL36 (40V) commands
-bool bl36_testmode();
-bool bl36_voltages(float voltages[]);
+inline bool bl36_testmode() { return cmd_exec(CMD_BL36_TESTMODE, g_buf); }
+bool bl36_voltages(Telemetry* out);
 
 #endif
@@ -3,8 +3,11 @@
  */
 
 #include "makita_data.h"
+#include "makita_chip.h"
 #include "makita_comm.h"
 #include "makita_commands.h"
+#include "makita_msg.h"
+#include "makita_timing.h"
 
 // ============== Utility ==============
 
@@ -14,12 +17,12 @@ int round5(int in) {
 }
 
 // Calculate SOC from cell voltage (Li-ion curve)
-uint8_t voltage_to_soc(float voltage) {
-  if (voltage >= 4.20f) return 100;
-  if (voltage <= 3.00f) return 0;
+uint8_t voltage_to_soc(uint16_t cell_mv) {
+  if (cell_mv >= 4200) return 100;
+  if (cell_mv <= 3000) return 0;
   // Linear approximation between 3.0V (0%) and 4.2V (100%)
   // More accurate for mid-range, slight error at extremes
-  return (uint8_t)((voltage - 3.0f) * 83.33f);
+  return (cell_mv - 3000) / 12;
 }
 
 // ============== Capacity helpers ==============
@@ -49,25 +52,19 @@ int get_capacity_for_model(byte cap_byte) {
 
 bool has_health() {
   byte rsp[4];
-  memset(rsp, 0, 4);
-  byte cmd_params[] = { 0xD4, 0xBA, 0x00, 0x01 };
-  cmd_and_read_cc(cmd_params, 4, rsp, 2);
+  cmd_exec(CMD_STATUS_BA, rsp);
   return rsp[1] == 0x06;
 }
 
 byte overload() {
-  byte rsp[16];
-  memset(rsp, 0, 16);
-  byte cmd_params[] = { 0xD4, 0x8D, 0x00, 0x07 };
-  cmd_and_read_cc(cmd_params, 4, rsp, 8);
+  byte rsp[8];
+  cmd_exec(CMD_OVERLOAD, rsp);
   return (rsp[5] & 0xf0) >> 4 | (rsp[6] & 0x70);
 }
 
 byte overdischarge() {
   byte rsp[4];
-  memset(rsp, 0, 4);
-  byte cmd_params[] = { 0xD4, 0xBA, 0x00, 0x01 };
-  cmd_and_read_cc(cmd_params, 4, rsp, 2);
+  cmd_exec(CMD_STATUS_BA, rsp);
   if (rsp[0] == 0xFF) return 0;
   int val = rsp[0] << 1;
   return (val > 100) ? 100 : val;
@@ -75,9 +72,7 @@ byte overdischarge() {
 
 byte health() {
   byte rsp[4];
-  memset(rsp, 0, 4);
-  byte cmd_params[] = { 0xD4, 0x50, 0x01, 0x02 };
-  cmd_and_read_cc(cmd_params, 4, rsp, 3);
+  cmd_exec(CMD_HEALTH, rsp);
   if (rsp[1] == 0xFF || rsp[1] < 10) return 100;
   int val = 14 * (rsp[1] - 10);
   return (val > 100) ? 100 : ((val < 0) ? 0 : val);
@@ -85,150 +80,167 @@ byte health() {
 
 // ============== Temperature ==============
 
-float cell_temperature() {
-  byte rsp[4];
-  memset(rsp, 0, 4);
-  byte cmd_params[] = { 0xD7, 0x0E, 0x00, 0x02 };
-  cmd_and_read_cc(cmd_params, 4, rsp, 3);
-  if (rsp[0] == 0xFF && rsp[1] == 0xFF) return -999.0f;
-  return (((rsp[0]) | ((int32_t)rsp[1]) << 8) / 10.0f) - 273.15f;
+static inline uint16_t get_u16(const byte* p) {
+  return p[0] | ((uint16_t)p[1] << 8);
+}
+
+// Data block temperature: 0.1 K little-endian, FFFF = no sensor.
+// 273.15 K = 2731.5 deci-K; rounded half away from zero.
+static int16_t decode_temperature(const byte* raw) {
+  if (raw[0] == 0xFF && raw[1] == 0xFF) return TEMP_NONE;
+  int32_t half = 2 * (int32_t)get_u16(raw) - 5463;  // 0.05 C units
+  return (int16_t)((half >= 0 ? half + 1 : half - 1) / 2);
 }
 
-float mosfet_temperature() {
+int16_t cell_temperature() {
   byte rsp[4];
-  memset(rsp, 0, 4);
-  byte cmd_params[] = { 0xD7, 0x10, 0x00, 0x02 };
-  cmd_and_read_cc(cmd_params, 4, rsp, 3);
-  if (rsp[0] == 0xFF && rsp[1] == 0xFF) return -999.0f;
-  return (((rsp[0]) | ((int32_t)rsp[1]) << 8) / 10.0f) - 273.15f;
+  cmd_exec(CMD_CELL_TEMP, rsp);
+  return decode_temperature(rsp);
 }
 
-// ============== Voltage info ==============
+int16_t mosfet_temperature() {
+  byte rsp[4];
+  cmd_exec(CMD_MOSFET_TEMP, rsp);
+  return decode_temperature(rsp);
+}
 
-bool get_voltage_info(float output[]) {
-  bool f0513_mode = false;
-  uint8_t data[128];
-  memset(data, 0, 128);
+// Both sensors in one transaction (data block offsets 14-17)
+bool read_temperatures(int16_t* t_cell, int16_t* t_mosfet) {
+  byte rsp[4];
+  cmd_exec(CMD_TEMPS, rsp);
+  *t_cell = decode_temperature(rsp);
+  *t_mosfet = decode_temperature(rsp + 2);
+  return *t_cell != TEMP_NONE;
+}
 
-  read_data_request(data);
+// ============== Voltage info ==============
 
-  float t_cell = 0;
-  float t_mosfet = 0;
+void telemetry_totals(Telemetry* t) {
+  uint16_t max_mv = 0, min_mv = 0xFFFF;
 
-  if (data[0] == 0xff && data[1] == 0xff) {
-    memset(data, 0xff, 32);
-    f0513_mode = true;
-  } else {
-    t_cell = cell_temperature();
-    t_mosfet = mosfet_temperature();
+  t->pack_mv = 0;
+  for (uint8_t i = 0; i < t->cell_count; i++) {
+    uint16_t mv = t->cell_mv[i];
+    t->pack_mv += mv;
+    if (mv > max_mv) max_mv = mv;
+    if (mv < min_mv) min_mv = mv;
   }
+  t->diff_mv = t->cell_count ? max_mv - min_mv : 0;
+}
 
-  if (f0513_mode) {
-    f0513_vcell_cmd(0x31, data + 2);
-    f0513_vcell_cmd(0x32, data + 4);
-    f0513_vcell_cmd(0x33, data + 6);
-    f0513_vcell_cmd(0x34, data + 8);
-    f0513_vcell_cmd(0x35, data + 10);
-    f0513_temp_cmd(data + 14);
-    int temp_raw = ((int)data[14] | ((int)data[15]) << 8);
-    float temp_100 = temp_raw / 100.0f;
-    float temp_256 = temp_raw / 256.0f;
-    t_cell = (temp_100 > 45.0f) ? temp_256 : temp_100;
-    t_mosfet = 0;
-  }
+// Cells in mV at offsets 2-11, temperatures at 14 and 16
+bool decode_data_block(const byte* data, Telemetry* out) {
+  bool doubled = false;
 
   if (data[2] == 0xff && data[3] == 0xff) return false;
 
-  // Read raw voltage values
-  float v_cell1 = ((int)data[2] | ((int)data[3]) << 8) / 1000.0f;
-  float v_cell2 = ((int)data[4] | ((int)data[5]) << 8) / 1000.0f;
-  float v_cell3 = ((int)data[6] | ((int)data[7]) << 8) / 1000.0f;
-  float v_cell4 = ((int)data[8] | ((int)data[9]) << 8) / 1000.0f;
-  float v_cell5 = ((int)data[10] | ((int)data[11]) << 8) / 1000.0f;
+  out->cell_count = 5;
+  for (uint8_t i = 0; i < 5; i++) {
+    out->cell_mv[i] = get_u16(data + 2 + 2 * i);
+    if (out->cell_mv[i] > 5000) doubled = true;
+  }
 
   // Old chips return doubled voltages - correct if > 5V
-  if (v_cell1 > 5.0f || v_cell2 > 5.0f || v_cell3 > 5.0f ||
-      v_cell4 > 5.0f || v_cell5 > 5.0f) {
-    v_cell1 /= 2.0f;
-    v_cell2 /= 2.0f;
-    v_cell3 /= 2.0f;
-    v_cell4 /= 2.0f;
-    v_cell5 /= 2.0f;
+  if (doubled) {
+    for (uint8_t i = 0; i < 5; i++) out->cell_mv[i] /= 2;
   }
 
-  float max_v = v_cell1, min_v = v_cell1;
-  if (v_cell2 > max_v) max_v = v_cell2;
-  if (v_cell3 > max_v) max_v = v_cell3;
-  if (v_cell4 > max_v) max_v = v_cell4;
-  if (v_cell5 > max_v) max_v = v_cell5;
-  if (v_cell2 < min_v) min_v = v_cell2;
-  if (v_cell3 < min_v) min_v = v_cell3;
-  if (v_cell4 < min_v) min_v = v_cell4;
-  if (v_cell5 < min_v) min_v = v_cell5;
-
-  output[0] = v_cell1;
-  output[1] = v_cell2;
-  output[2] = v_cell3;
-  output[3] = v_cell4;
-  output[4] = v_cell5;
-  output[5] = max_v - min_v;
-  output[6] = v_cell1 + v_cell2 + v_cell3 + v_cell4 + v_cell5;
-  output[7] = t_cell;
-  output[8] = t_mosfet;
+  out->t_cell = decode_temperature(data + 14);
+  out->t_mosfet = decode_temperature(data + 16);
+  telemetry_totals(out);
+  return true;
+}
+
+bool get_voltage_info(Telemetry* out) {
+  uint8_t data[32];
+  memset(out, 0, sizeof(Telemetry));
+
+  read_data_request(data);
+
+  if (data[0] == 0xff && data[1] == 0xff) return false;
+  return decode_data_block(data, out);
+}
+
+// F0513: one command per cell and a single temperature
+bool f0513_voltages(Telemetry* out) {
+  uint8_t data[32];
+  memset(out, 0, sizeof(Telemetry));
+  memset(data, 0xff, 32);
+  f0513_vcell_cmd(0x31, data + 2);
+  f0513_vcell_cmd(0x32, data + 4);
+  f0513_vcell_cmd(0x33, data + 6);
+  f0513_vcell_cmd(0x34, data + 8);
+  f0513_vcell_cmd(0x35, data + 10);
+  f0513_temp_cmd(data + 14);
+
+  if (!decode_data_block(data, out)) return false;
+
+  // Temperature is in 0.01 C, or 1/256 C on some chips; FF FF = no answer
+  uint16_t temp_raw = get_u16(data + 14);
+  if (temp_raw == 0xFFFF) out->t_cell = TEMP_NONE;
+  else out->t_cell = (temp_raw > 4500) ? (int16_t)((uint32_t)temp_raw * 10 / 256) : (int16_t)(temp_raw / 10);
+  out->t_mosfet = TEMP_NONE;
   return true;
 }
 
 // ============== Checksum functions ==============
 
-// Calculate checksum for nybble range: min(sum, 0xff) & 0x0f
-static byte calcNybbleSum(const byte* msg, int startByte, int endByte, bool lastLowOnly) {
-  int sum = 0;
-  int end = lastLowOnly ? endByte - 1 : endByte;
-  for (int i = startByte; i <= end; i++) {
-    sum += (msg[i] & 0x0F) + (msg[i] >> 4);
+// All five checksums in one pass: each is min(sum of its nybbles, 0xff) & 0x0f
+// over nybbles 0-15, 16-31, 32-40, 44-47 and 48-61
+void msgChecksums(const byte* msg, byte chk[5]) {
+  uint16_t sum[5] = { 0, 0, 0, 0, 0 };
+
+  for (uint8_t i = 0; i < 31; i++) {
+    uint8_t k;
+    if (i < 20) k = i >> 3;           // Bytes 0-7, 8-15, 16-19
+    else if (i == 20) {
+      sum[2] += msg[i] & 0x0F;        // Nybble 40 (error), not 41 (chk1)
+      continue;
+    } else if (i == 21) continue;     // chk2/chk3
+    else k = (i < 24) ? 3 : 4;        // Bytes 22-23, 24-30
+    sum[k] += (msg[i] & 0x0F) + (msg[i] >> 4);
   }
-  if (lastLowOnly) {
-    sum += (msg[endByte] & 0x0F);
+
+  for (uint8_t k = 0; k < 5; k++) {
+    chk[k] = (sum[k] > 255 ? 255 : sum[k]) & 0x0F;
   }
-  return (sum > 255 ? 255 : sum) & 0x0F;
 }
 
 bool verifyMsgChecksums(const byte* msg) {
-  if (msg[20] == 0xFF && msg[21] == 0xFF) return false;
-
-  // Primary checksums (control lock status)
-  byte chk1 = calcNybbleSum(msg, 0, 7, false);   // nybbles 0-15
-  byte chk2 = calcNybbleSum(msg, 8, 15, false);  // nybbles 16-31
-  byte chk3 = calcNybbleSum(msg, 16, 20, true);  // nybbles 32-40
-
-  bool primary_ok = (chk1 == (msg[20] >> 4)) &&
-                    (chk2 == (msg[21] & 0x0F)) &&
-                    (chk3 == (msg[21] >> 4));
+  ConstMsgView v(msg);
+  byte chk[5];
 
-  // Secondary checksums (for data integrity)
-  byte chk4 = calcNybbleSum(msg, 22, 23, false); // nybbles 44-47
-  byte chk5 = calcNybbleSum(msg, 24, 30, false); // nybbles 48-61
-
-  bool secondary_ok = (chk4 == (msg[31] & 0x0F)) &&
-                      (chk5 == (msg[31] >> 4));
+  if (msg[20] == 0xFF && msg[21] == 0xFF) return false;
 
-  return primary_ok && secondary_ok;
+  msgChecksums(msg, chk);
+  return chk[0] == v.get(MSG_CHK1) && chk[1] == v.get(MSG_CHK2) && chk[2] == v.get(MSG_CHK3) &&
+         chk[3] == v.get(MSG_CHK4) && chk[4] == v.get(MSG_CHK5);
 }
 
 void recalcMsgChecksums(byte* msg) {
-  // Primary checksums (nybbles 41-43) - these control lock status
-  byte chk1 = calcNybbleSum(msg, 0, 7, false);   // nybbles 0-15
-  byte chk2 = calcNybbleSum(msg, 8, 15, false);  // nybbles 16-31
-  byte chk3 = calcNybbleSum(msg, 16, 20, true);  // nybbles 32-40
-
-  msg[20] = (msg[20] & 0x0F) | (chk1 << 4);
-  msg[21] = (chk2 & 0x0F) | (chk3 << 4);
+  MsgView v(msg);
+  byte chk[5];
+
+  msgChecksums(msg, chk);
+  v.set(MSG_CHK1, chk[0]);
+  v.set(MSG_CHK2, chk[1]);
+  v.set(MSG_CHK3, chk[2]);
+  v.set(MSG_CHK4, chk[3]);
+  v.set(MSG_CHK5, chk[4]);
+}
 
-  // Secondary checksums (nybbles 62-63) - for cycle count etc.
-  byte chk4 = calcNybbleSum(msg, 22, 23, false); // nybbles 44-47
-  byte chk5 = calcNybbleSum(msg, 24, 30, false); // nybbles 48-61
+bool msgDiff(const byte* a, const byte* b, byte mask[MSG_DIFF_BYTES]) {
+  byte any = 0;
 
-  msg[31] = (chk4 & 0x0F) | (chk5 << 4);
+  memset(mask, 0, MSG_DIFF_BYTES);
+  for (uint8_t i = 0; i < 32; i++) {
+    byte x = a[i] ^ b[i];
+    uint8_t n = 2 * i;
+    if (x & 0x0F) mask[n >> 3] |= 1 << (n & 7);
+    if (x & 0xF0) mask[n >> 3] |= 2 << (n & 7);
+    any |= x;
+  }
+  return any;
 }
 
 // ============== Lock status ==============
@@ -238,31 +250,31 @@ bool isBatteryLocked() {
   memset(data, 0, 64);
   if (!try_charger(data)) return true;
 
-  byte* msg = data + 8;
-  byte err = msg[20] & 0x0F;
+  ConstMsgView msg(data + 8);
 
-  // Error code check (0=OK, 5=Warning are acceptable)
-  if (err != 0 && err != 5) return true;
-
-  // Verify checksums
-  return !verifyMsgChecksums(msg);
+  // Error code check (0=OK, 5=Warning are acceptable), then checksums
+  return msg.errorLocks() || !msg.checksumsOk();
 }
 
 // ============== Cached data read ==============
 
-bool readAllBatteryData() {
+static bool readBattery() {
   // Clear previous data
   memset(&g_battery, 0, sizeof(g_battery));
   g_battery.valid = false;
 
-  // Warm up the battery first
-  warmup_battery();
+  // ROM and MSG at default timing - the pack may have been swapped
+  timing_apply(TIMING_DEFAULT);
+
+  // Warm up the battery only if it may have gone to sleep
+  bus_ensure_awake();
 
   // Read charger data (ROM + MSG) - this is the most important
   byte charger_data[48];
-  memset(charger_data, 0, 48);
+  BusResult res;
 
-  if (!try_charger(charger_data)) {
+  if (!cmd_exec(CMD_CHARGER, charger_data, 0, &res)) {
+    g_battery.bus_status = res.last;
     return false;
   }
 
@@ -270,35 +282,24 @@ bool readAllBatteryData() {
   memcpy(g_battery.rom, charger_data, 8);
   memcpy(g_battery.msg, charger_data + 8, 32);
 
-  // IMPORTANT: After 0x33 commands, first 0xCC commands fail
-  // Do warm-up reads before voltage reading
-  makita.reset();
-  delay(100);
-  cell_temperature();  // discard
-  delay(50);
-  cell_temperature();  // discard
-  delay(50);
-
-  // Try to read voltages (5-cell standard)
-  if (get_voltage_info(g_battery.voltages)) {
-    g_battery.cell_count = 5;
-    g_battery.is_bl36 = false;
-    g_battery.valid = true;
-    return true;
-  }
+  // Calibrated timing for this pack, if any
+  timing_apply_for_rom(g_battery.rom);
 
-  // Try BL36 (10-cell 40V)
-  float bl36_data[13];
-  if (bl36_voltages(bl36_data)) {
-    memcpy(g_battery.voltages, bl36_data, sizeof(g_battery.voltages));
-    g_battery.cell_count = 10;
-    g_battery.is_bl36 = true;
-    g_battery.valid = true;
-    return true;
-  }
+  // The 0xCC quirk after the charger command is absorbed by cmd_and_read()
 
-  // Charger data is valid even without voltages
+  // Voltages through the pack's driver; charger data is valid even without them
+  g_battery.chip = chip_probe(g_battery.rom, &g_battery.tm);
   g_battery.valid = true;
-  g_battery.cell_count = 0;
   return true;
 }
+
+bool readAllBatteryData() {
+  uint16_t resets = hal_reset_count;
+  uint32_t t0 = millis();
+
+  bool ok = readBattery();
+
+  g_battery.read_ms = millis() - t0;
+  g_battery.bus_resets = hal_reset_count - resets;
+  return ok;
+}
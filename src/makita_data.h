@@ -9,7 +9,7 @@
 
 // Utility
 int round5(int in);
-uint8_t voltage_to_soc(float voltage);
+uint8_t voltage_to_soc(uint16_t cell_mv);
 
 // Capacity helpers
 bool is_new_capacity_format(byte cap_byte);
@@ -22,18 +22,28 @@ byte overload();
 byte overdischarge();
 byte health();
 
-// Temperature
-float cell_temperature();
-float mosfet_temperature();
+// Temperature (0.1 C, TEMP_NONE if not available)
+int16_t cell_temperature();
+int16_t mosfet_temperature();
+bool read_temperatures(int16_t* t_cell, int16_t* t_mosfet);
 
-// Voltage info (output array: [0-4]=cells, [5]=diff, [6]=pack, [7]=t_cell, [8]=t_mosfet)
-bool get_voltage_info(float output[]);
+// Voltage info
+bool get_voltage_info(Telemetry* out);                      // Standard: 0xD7 data block
+bool f0513_voltages(Telemetry* out);                        // F0513: per-cell commands
+bool decode_data_block(const byte* data, Telemetry* out);  // 0xD7 block, 5 cells
+void telemetry_totals(Telemetry* t);                        // diff_mv and pack_mv
 
 // Checksum functions (per protocol docs)
 // Calculates checksum for MSG: min(sum(nybbles), 0xff) & 0x0f
+void msgChecksums(const byte* msg, byte chk[5]);  // chk1..chk5, single pass
 bool verifyMsgChecksums(const byte* msg);
 void recalcMsgChecksums(byte* msg);
 
+// Nybbles that differ between two MSGs: bit n & 7 of mask[n >> 3] = nybble n
+// (low nybble of byte n/2 first). Returns false if the MSGs are equal.
+#define MSG_DIFF_BYTES 8
+bool msgDiff(const byte* a, const byte* b, byte mask[MSG_DIFF_BYTES]);
+
 // Lock status check
 bool isBatteryLocked();
 
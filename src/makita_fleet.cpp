@@ -0,0 +1,152 @@
+/*
+ * Makita Battery Reader - Hot-swap Fleet Scan
+ */
+
+#include "makita_fleet.h"
+#include "makita_chip.h"
+#include "makita_comm.h"
+#include "makita_commands.h"
+#include "makita_data.h"
+#include "makita_msg.h"
+#include "makita_print.h"
+#include "makita_task.h"
+
+static Task fleet_task;
+static bool fleet_running = false;
+static bool fleet_stop = false;
+
+static uint32_t fleet_start_ms;
+static uint16_t fleet_packs;
+static uint16_t fleet_failed;
+static uint8_t fleet_polls;
+static uint32_t fleet_next;  // Next poll without an edge
+
+// ============== Output ==============
+
+// n,t_ms,rom,cycles,error,locked,capacity_mah,cells,pack_mv,diff_mv,health,read_ms
+static void fleet_record(uint32_t t_ms) {
+  ConstMsgView msg(g_battery.msg);
+  const Telemetry* tm = &g_battery.tm;
+
+  Serial.print(fleet_packs);
+  printCell(t_ms);
+  Serial.print(',');
+  printPackCells(g_battery.rom, g_battery.msg);
+  printCell(get_capacity_mah(msg.get(MSG_CAPACITY)));
+  printCell(tm->cell_count);
+  Serial.print(',');
+  if (tm->cell_count) Serial.print(tm->pack_mv);
+  Serial.print(',');
+  if (tm->cell_count) Serial.print(tm->diff_mv);
+  Serial.print(',');
+  if (chip_has_health()) Serial.print(health());
+  printCell(g_battery.read_ms);
+  Serial.println();
+}
+
+static void fleet_summary() {
+  uint32_t elapsed = millis() - fleet_start_ms;
+
+  Serial.print(F("# Stopped: "));
+  Serial.print(fleet_packs);
+  Serial.print(F(" packs ("));
+  Serial.print(fleet_failed);
+  Serial.print(F(" failed) in "));
+  Serial.print(elapsed / 1000);
+  Serial.print(F(" s, "));
+  printFixed(elapsed ? (uint64_t)fleet_packs * 36000000 / elapsed : 0, 1);
+  Serial.println(F(" packs/h"));
+}
+
+// ============== Polling ==============
+
+static bool fleet_due() {
+  return hal_line_changed() || (int32_t)(millis() - fleet_next) >= 0;
+}
+
+// After a poll: drop the edges it made, and look again soon while a
+// change is being confirmed
+static void fleet_polled() {
+  hal_line_changed();
+  fleet_next = millis() + (fleet_polls ? FLEET_BOUNCE_MS : FLEET_POLL_MS);
+}
+
+// ============== Task ==============
+
+static uint8_t fleetTask(Task* t) {
+  TASK_BEGIN(t);
+
+  Serial.println(F("# Fleet scan - insert packs one at a time, 'x' stops"));
+  Serial.println(F("# n,t_ms,rom,cycles,error,locked,capacity_mAh,cells,pack_mV,diff_mV,health,read_ms"));
+  fleet_start_ms = millis();
+  hal_watch_line(true);
+
+  while (!fleet_stop) {
+    // Wait for a pack: an edge on the data line or the slow poll, then a
+    // few presence pulses in a row and time to settle
+    fleet_polls = 0;
+    fleet_next = millis();
+    while (!fleet_stop && fleet_polls < FLEET_SEEN_POLLS) {
+      if (fleet_due()) {
+        fleet_polls = hal_reset() ? fleet_polls + 1 : 0;
+        fleet_polled();
+      }
+      if (fleet_polls < FLEET_SEEN_POLLS) TASK_SLEEP(t, FLEET_WATCH_MS);
+    }
+    if (fleet_stop) break;
+    TASK_SLEEP(t, FLEET_SETTLE_MS);
+
+    // New pack - whatever the bus knew belongs to the last one
+    bus_forget();
+    fleet_packs++;
+    if (readAllBatteryData()) {
+      fleet_record(millis() - fleet_start_ms);
+    } else {
+      fleet_failed++;
+      Serial.print(F("# "));
+      Serial.print(fleet_packs);
+      Serial.print(F(": read failed - "));
+      printBusStatus(g_battery.bus_status);
+    }
+
+    // Wait for removal; ROM reads keep a pack that stays in awake, and a
+    // pack that only answers with a presence pulse still counts as there
+    fleet_polls = 0;
+    fleet_polled();
+    while (!fleet_stop && fleet_polls < FLEET_GONE_POLLS) {
+      if (fleet_due()) {
+        fleet_polls = (bus_poll_rom() || hal_reset()) ? 0 : fleet_polls + 1;
+        fleet_polled();
+      }
+      if (fleet_polls < FLEET_GONE_POLLS) TASK_SLEEP(t, FLEET_WATCH_MS);
+    }
+    bus_forget();
+  }
+
+  hal_watch_line(false);
+  fleet_summary();
+  fleet_running = false;
+  TASK_END(t);
+}
+
+bool fleetStart() {
+  if (fleet_running) return false;
+
+  fleet_stop = false;
+  fleet_packs = 0;
+  fleet_failed = 0;
+
+  if (!taskStart(&fleet_task, fleetTask, NULL)) return false;
+  fleet_running = true;
+  return true;
+}
+
+void fleetStop() {
+  if (!fleet_running) return;
+  fleet_stop = true;
+  fleet_task.wake = millis();
+}
+
+bool fleetActive() {
+  return fleet_running;
+}
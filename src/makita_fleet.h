@@ -0,0 +1,28 @@
+/*
+ * Makita Battery Reader - Hot-swap Fleet Scan
+ *
+ * Unattended intake: a background task waits for a pack, reads each newly
+ * inserted one once, prints one CSV record keyed by ROM ID and then waits
+ * for the pack to be pulled before it looks for the next one. An edge on
+ * the data line (pin-change interrupt) is checked at once; the slow poll
+ * catches packs that attach or leave without one.
+ * Stopping prints the pack count and the throughput in packs per hour.
+ */
+
+#ifndef MAKITA_FLEET_H
+#define MAKITA_FLEET_H
+
+#include "config.h"
+
+#define FLEET_POLL_MS     250  // Between polls without an edge
+#define FLEET_BOUNCE_MS   20   // Between polls that confirm a change
+#define FLEET_WATCH_MS    1    // Edge check
+#define FLEET_SEEN_POLLS  2    // Consecutive presence pulses that mean "inserted"
+#define FLEET_GONE_POLLS  3    // Consecutive misses that mean "removed"
+#define FLEET_SETTLE_MS   300  // Contacts settling after insertion
+
+bool fleetStart();
+void fleetStop();    // Summary follows once the current pack is done
+bool fleetActive();
+
+#endif
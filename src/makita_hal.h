@@ -0,0 +1,144 @@
+/*
+ * Makita Battery Reader - Hardware Abstraction Layer
+ *
+ * Bus and enable-pin primitives used by the protocol code. On the board
+ * these are inline wrappers around OneWire and digitalWrite(), so they cost
+ * nothing. The native build links them against a simulated battery
+ * (makita_hal_native.cpp) and gets delay()/millis() from lib/ArduinoNative,
+ * which runs a virtual clock instead of sleeping.
+ *
+ * Slot timings can be changed at runtime (hal_set_timing) while the bus is
+ * idle; hal_default_timing() returns the conservative OBI values.
+ *
+ * hal_watch_line() arms a pin-change interrupt on the data line, so attach
+ * and detach show up as an edge without bus traffic. hal_idle() sleeps the
+ * MCU until the next interrupt (USART RX, the pin change, or the millis()
+ * tick) on the board; natively the serial poll already advances the clock.
+ *
+ * hal_transfer_*() run a whole reset + read/write sequence in the background
+ * on the Timer1 engine (lib/OneWire/OneWireAsync) where it is available, and
+ * synchronously elsewhere.
+ *
+ * hal_rack_*() drive the optional battery rack (RACK_SLOTS in config.h)
+ * bit-parallel through lib/OneWire/OneWirePort; the native build simulates
+ * one pack per slot.
+ *
+ * Included from config.h after the pin definitions.
+ */
+
+#ifndef MAKITA_HAL_H
+#define MAKITA_HAL_H
+
+#include <Arduino.h>
+
+// Bus activity so far (direct and by transfers), for statistics
+extern uint16_t hal_reset_count;
+extern uint32_t hal_tx_bytes;
+extern uint32_t hal_rx_bytes;
+
+// hal_transfer_status() results
+#define HAL_OK          0
+#define HAL_NO_PRESENCE 1
+#define HAL_BUSY        2
+#define HAL_NO_ANSWER   3  // Stopped at a probe segment that read all 0xFF
+
+#if RACK_SLOTS
+// Battery rack: the slots are clocked together, so a byte to or from every
+// pack takes the bus time of one. A slot mask selects packs (bit n = slot n).
+// Per-slot buffers are strided - slot n's bytes start at buf + n * stride -
+// and a write with stride 0 sends the same bytes to every slot.
+void hal_rack_init();
+uint8_t hal_rack_reset(uint8_t slots);  // Slots that answered with a presence pulse
+void hal_rack_write_bytes(const uint8_t* buf, uint8_t count, uint8_t slots, uint8_t stride);
+void hal_rack_read_bytes(uint8_t* buf, uint8_t count, uint8_t slots, uint8_t stride);
+void hal_rack_set_enable(uint8_t slots);  // These slots powered, the others off
+#endif
+
+#if defined(ARDUINO)
+
+#include <OneWire2.h>
+#include <OneWireAsync.h>
+extern OneWire makita;
+
+typedef OneWireSegment HalSegment;
+typedef OneWireTiming HalTiming;
+
+#define HAL_SEG_PROBE ONEWIRE_SEG_PROBE
+inline bool hal_seg_dead(const HalSegment* seg) { return onewire_seg_dead(seg); }
+
+inline void hal_init() {
+  pinMode(ONEWIRE_PIN, INPUT);
+  pinMode(ENABLE_PIN, OUTPUT);
+  digitalWrite(ENABLE_PIN, HIGH);
+#if RACK_SLOTS
+  hal_rack_init();
+#endif
+}
+
+inline bool hal_reset() { hal_reset_count++; return makita.reset(); }
+inline void hal_write(uint8_t v) { hal_tx_bytes++; makita.write(v); }
+inline void hal_write_bytes(const uint8_t* buf, uint16_t count) { hal_tx_bytes += count; makita.write_bytes(buf, count); }
+inline uint8_t hal_read() { hal_rx_bytes++; return makita.read(); }
+inline void hal_read_bytes(uint8_t* buf, uint16_t count) { hal_rx_bytes += count; makita.read_bytes(buf, count); }
+inline void hal_set_enable(bool high) { digitalWrite(ENABLE_PIN, high ? HIGH : LOW); }
+
+inline void hal_get_timing(HalTiming* t) { *t = OneWire::timing; }
+inline void hal_set_timing(const HalTiming* t) { OneWire::timing = *t; }
+inline void hal_default_timing(HalTiming* t) { OneWire::default_timing(t); }
+
+#else
+
+struct HalSegment {
+  uint8_t* buf;
+  uint8_t len;
+  uint8_t read;   // 1 = read into buf, 0 = write from buf, 2 = probe
+};
+
+#define HAL_SEG_PROBE 2
+
+// Probe segments end the transfer when they read nothing but 0xFF
+bool hal_seg_dead(const HalSegment* seg);
+
+// Slot timings in microseconds, same layout as OneWireTiming
+struct HalTiming {
+  uint16_t reset_low;
+  uint16_t reset_sample;
+  uint16_t reset_tail;
+  uint8_t w1_low;
+  uint8_t w1_high;
+  uint8_t w0_low;
+  uint8_t w0_high;
+  uint8_t r_low;
+  uint8_t r_sample;
+  uint8_t r_tail;
+};
+
+void hal_init();
+bool hal_reset();
+void hal_write(uint8_t v);
+void hal_write_bytes(const uint8_t* buf, uint16_t count);
+uint8_t hal_read();
+void hal_read_bytes(uint8_t* buf, uint16_t count);
+void hal_set_enable(bool high);
+
+void hal_get_timing(HalTiming* t);
+void hal_set_timing(const HalTiming* t);
+void hal_default_timing(HalTiming* t);
+
+#endif
+
+// Data line edges (attach / detach). Our own bus traffic makes edges too -
+// call hal_line_changed() after it to drop them.
+void hal_watch_line(bool on);
+bool hal_line_changed();  // Edge since the last call
+void hal_idle();          // Sleep until an interrupt
+
+// Background transfer: reset, gap_us, then segments (kept valid until done).
+// A dead probe segment (HAL_SEG_PROBE) ends it early with HAL_NO_ANSWER.
+// Returns false if a transfer is already running.
+bool hal_transfer_start(const HalSegment* segs, uint8_t count, uint16_t gap_us);
+bool hal_transfer_busy();
+uint8_t hal_transfer_status();
+uint32_t hal_transfer_cpu_cycles();  // CPU cycles the last transfer cost
+
+#endif
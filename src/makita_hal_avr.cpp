@@ -0,0 +1,196 @@
+/*
+ * Makita Battery Reader - Hardware Abstraction Layer (board)
+ */
+
+#include "config.h"
+
+#if defined(ARDUINO)
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#if RACK_SLOTS
+#include <OneWirePort.h>
+#endif
+
+// Global OneWire instance
+OneWire makita(ONEWIRE_PIN);
+
+uint16_t hal_reset_count = 0;
+uint32_t hal_tx_bytes = 0;
+uint32_t hal_rx_bytes = 0;
+
+// Bytes a finished transfer moved - none without presence, and nothing
+// after a dead probe
+static void count_segments(const HalSegment* segs, uint8_t count, uint8_t status) {
+  if (status == HAL_NO_PRESENCE) return;
+  for (uint8_t i = 0; i < count; i++) {
+    if (segs[i].read) hal_rx_bytes += segs[i].len;
+    else hal_tx_bytes += segs[i].len;
+    if (status == HAL_NO_ANSWER && hal_seg_dead(&segs[i])) break;
+  }
+}
+
+// ============== Line watch ==============
+
+// Pin-change group of the data line (ATmega328: D0-7, D8-13, A0-5)
+#if ONEWIRE_PIN <= 7
+#define LINE_PCINT_vect PCINT2_vect
+#elif ONEWIRE_PIN <= 13
+#define LINE_PCINT_vect PCINT0_vect
+#else
+#define LINE_PCINT_vect PCINT1_vect
+#endif
+
+static volatile bool line_changed;
+
+ISR(LINE_PCINT_vect) {
+  line_changed = true;
+}
+
+void hal_watch_line(bool on) {
+  uint8_t bit = _BV(digitalPinToPCMSKbit(ONEWIRE_PIN));
+  uint8_t group = _BV(digitalPinToPCICRbit(ONEWIRE_PIN));
+
+  noInterrupts();
+  if (on) {
+    *digitalPinToPCMSK(ONEWIRE_PIN) |= bit;
+    PCIFR = group;  // Drop an edge from before
+    *digitalPinToPCICR(ONEWIRE_PIN) |= group;
+  } else {
+    *digitalPinToPCMSK(ONEWIRE_PIN) &= ~bit;
+    if (!*digitalPinToPCMSK(ONEWIRE_PIN)) *digitalPinToPCICR(ONEWIRE_PIN) &= ~group;
+  }
+  line_changed = false;
+  interrupts();
+}
+
+bool hal_line_changed() {
+  bool changed = line_changed;
+  line_changed = false;
+  return changed;
+}
+
+// Idle mode keeps Timer0, Timer1 and the USART running. Interrupts are only
+// enabled by the instruction before SLEEP, so a byte or edge that arrives
+// after the check still ends the sleep.
+void hal_idle() {
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  noInterrupts();
+  if (!line_changed && !Serial.available()) {
+    sleep_enable();
+    interrupts();
+    sleep_cpu();
+    sleep_disable();
+  }
+  interrupts();
+}
+
+// ============== Transfers ==============
+
+#if ONEWIRE_ASYNC
+
+static OneWireAsync makita_async(ONEWIRE_PIN);
+
+// Running transfer, counted once it is done
+static const HalSegment* xfer_segs;
+static uint8_t xfer_count;
+
+static void xfer_done() {
+  if (!xfer_segs || makita_async.busy()) return;
+  count_segments(xfer_segs, xfer_count, makita_async.status());
+  xfer_segs = NULL;
+}
+
+bool hal_transfer_start(const HalSegment* segs, uint8_t count, uint16_t gap_us) {
+  xfer_done();
+  if (!makita_async.start(segs, count, gap_us)) return false;
+  hal_reset_count++;
+  xfer_segs = segs;
+  xfer_count = count;
+  return true;
+}
+
+bool hal_transfer_busy() {
+  if (makita_async.busy()) return true;
+  xfer_done();
+  return false;
+}
+
+uint8_t hal_transfer_status() {
+  xfer_done();
+  return makita_async.status();
+}
+uint32_t hal_transfer_cpu_cycles() { return makita_async.cpu_cycles(); }
+
+#else
+
+// No Timer1 engine on this board - run the transfer on the blocking driver
+static uint8_t xfer_status;
+static uint32_t xfer_cycles;
+
+bool hal_transfer_start(const HalSegment* segs, uint8_t count, uint16_t gap_us) {
+  uint32_t t0 = micros();
+
+  xfer_status = HAL_NO_PRESENCE;
+  if (hal_reset()) {
+    delayMicroseconds(gap_us);
+    xfer_status = HAL_OK;
+    for (uint8_t i = 0; i < count; i++) {
+      if (segs[i].read) makita.read_bytes(segs[i].buf, segs[i].len);
+      else makita.write_bytes(segs[i].buf, segs[i].len);
+      if (hal_seg_dead(&segs[i])) {
+        xfer_status = HAL_NO_ANSWER;
+        break;
+      }
+    }
+    count_segments(segs, count, xfer_status);
+  }
+  xfer_cycles = (micros() - t0) * (F_CPU / 1000000UL);
+  return true;
+}
+
+bool hal_transfer_busy() { return false; }
+uint8_t hal_transfer_status() { return xfer_status; }
+uint32_t hal_transfer_cpu_cycles() { return xfer_cycles; }
+
+#endif
+
+// ============== Rack ==============
+
+#if RACK_SLOTS
+
+static const uint8_t rack_data_pins[RACK_SLOTS] = RACK_DATA_PINS;
+static const uint8_t rack_enable_pins[RACK_SLOTS] = RACK_ENABLE_PINS;
+static OneWirePort makita_rack;
+
+void hal_rack_init() {
+  makita_rack.begin(rack_data_pins, RACK_SLOTS);
+  for (uint8_t i = 0; i < RACK_SLOTS; i++) pinMode(rack_enable_pins[i], OUTPUT);
+  hal_rack_set_enable((1 << RACK_SLOTS) - 1);
+}
+
+// Counted once per call - the slots share the bus time
+uint8_t hal_rack_reset(uint8_t slots) {
+  hal_reset_count++;
+  return makita_rack.reset(slots);
+}
+
+void hal_rack_write_bytes(const uint8_t* buf, uint8_t count, uint8_t slots, uint8_t stride) {
+  hal_tx_bytes += count;
+  makita_rack.write_bytes(buf, count, slots, stride);
+}
+
+void hal_rack_read_bytes(uint8_t* buf, uint8_t count, uint8_t slots, uint8_t stride) {
+  hal_rx_bytes += count;
+  makita_rack.read_bytes(buf, count, slots, stride);
+}
+
+void hal_rack_set_enable(uint8_t slots) {
+  for (uint8_t i = 0; i < RACK_SLOTS; i++) {
+    digitalWrite(rack_enable_pins[i], (slots >> i) & 1 ? HIGH : LOW);
+  }
+}
+
+#endif
+
+#endif
@@ -0,0 +1,411 @@
+/*
+ * Makita Battery Reader - Hardware Abstraction Layer (native)
+ *
+ * Simulated battery for off-target builds. It answers the commands used by
+ * the firmware at the byte level and advances the virtual clock by the slot
+ * times the real bus would take, so timing comparisons stay meaningful.
+ * Slots shorter than the chip follows garble the transaction up to the next
+ * reset, as they would on a real pack.
+ *
+ * Environment:
+ *   MAKITA_SIM_CHIP   std (default), none (no battery connected) or mute
+ *                     (presence pulse, but no answers)
+ *   MAKITA_SIM_ERROR  error nibble stored in the MSGs, hex (default 0)
+ *   MAKITA_SIM_SWAP   hot-swap bench: ms in the slot, then as long out, repeated;
+ *                     every insertion is a pack with a new ROM serial
+ *   MAKITA_SIM_RACK   rack slots with a pack, hex mask (default all)
+ */
+
+#include "config.h"
+
+#if !defined(ARDUINO)
+
+#include "makita_data.h"
+
+// Defaults of the OBI-modified driver in lib/OneWire/OneWire2.h
+static const HalTiming SIM_DEFAULT_TIMING = { 750, 70, 410, 12, 120, 100, 30, 10, 10, 53 };
+static HalTiming timing = SIM_DEFAULT_TIMING;
+
+// Shortest slots the simulated chip still follows (a healthy pack)
+#define SIM_MIN_RESET_LOW 480
+#define SIM_MIN_SLOT      60   // Write slot, and write-0 low time
+#define SIM_MIN_READ_SLOT 45
+
+#define SIM_COMMIT_MS 40  // Programming 32 bytes of EEPROM
+
+struct SimBattery {
+  bool present;
+  bool mute;              // Presence pulse only
+  bool powered;
+  bool testmode;
+  bool cc_quirk;          // First 0xCC command after a 0x33 one fails
+  bool scratch_valid;
+  byte rom[8];
+  byte msg[32];
+  byte scratch[32];
+  byte data[32];          // 0xD7 data block
+  byte rx[48];            // Bytes written since the last reset
+  uint8_t rx_len;
+  byte tx[48];            // Queued response
+  uint8_t tx_len;
+  uint8_t tx_pos;
+  bool garbled;           // Timings too short - chip lost sync since reset
+  uint32_t busy_until;    // EEPROM programming - no presence pulse until then
+};
+
+static SimBattery sim;
+#if RACK_SLOTS
+static SimBattery sim_rack[RACK_SLOTS];
+#endif
+static uint32_t sim_swap_ms;     // 0 = the pack stays in
+static uint32_t sim_swap_phase;
+static bool sim_watch;           // Line watch armed
+static bool sim_edge;            // Pack came or went while armed
+
+uint16_t hal_reset_count = 0;
+uint32_t hal_tx_bytes = 0;
+uint32_t hal_rx_bytes = 0;
+
+static const byte SIM_ROM[8] = { 0x17, 0x05, 0x0C, 0x3A, 0x91, 0x00, 0x42, 0x1C };
+static const char SIM_MODEL[] = "BL1850";
+
+static bool sim_timing_ok() {
+  return timing.reset_low >= SIM_MIN_RESET_LOW &&
+         timing.w1_low + timing.w1_high >= SIM_MIN_SLOT &&
+         timing.w0_low >= SIM_MIN_SLOT &&
+         timing.r_low + timing.r_sample + timing.r_tail >= SIM_MIN_READ_SLOT;
+}
+
+static void sim_put16(byte* p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+static void sim_queue(SimBattery* b, const byte* data, uint8_t len) {
+  if (b->tx_len + len > sizeof(b->tx)) len = sizeof(b->tx) - b->tx_len;
+  memcpy(b->tx + b->tx_len, data, len);
+  b->tx_len += len;
+}
+
+static void sim_queue_fill(SimBattery* b, byte value, uint8_t len) {
+  byte fill[48];
+  memset(fill, value, sizeof(fill));
+  sim_queue(b, fill, len);
+}
+
+// Called after every written byte; answers once a known command is complete
+static void sim_process(SimBattery* b) {
+  byte* cmd = b->rx + 1;
+  uint8_t n = b->rx_len - 1;
+
+  if (b->mute) return;
+  if (b->rx[0] == 0x33) {
+    if (n == 0) sim_queue(b, b->rom, 8);
+  } else if (b->rx[0] == 0xCC) {
+    if (n == 0 && b->cc_quirk) {
+      b->cc_quirk = false;
+      b->rx[0] = 0x00;  // Ignore the rest of this transaction
+    }
+  } else {
+    return;  // F0513 / BL36 initial bytes - not supported by this chip
+  }
+
+  if (n == 0) return;
+
+  if (n == 2 && cmd[0] == 0xF0 && cmd[1] == 0x00 && b->rx[0] == 0x33) {
+    sim_queue(b, b->msg, 32);
+  } else if (n == 2 && cmd[0] == 0xAA && cmd[1] == 0x00) {
+    sim_queue(b, b->msg, 32);
+    sim_queue_fill(b, 0xFF, 8);
+  } else if (n == 2 && cmd[0] == 0xDC && cmd[1] == 0x0C) {
+    sim_queue(b, (const byte*)SIM_MODEL, 6);
+    sim_queue_fill(b, 0x00, 4);
+  } else if (n == 4 && cmd[0] == 0xD7) {
+    uint8_t off = cmd[1] < sizeof(b->data) ? cmd[1] : sizeof(b->data);
+    sim_queue(b, b->data + off, sizeof(b->data) - off);
+  } else if (n == 3 && cmd[0] == 0xD9 && cmd[1] == 0x96 && cmd[2] == 0xA5) {
+    b->testmode = true;
+    sim_queue_fill(b, 0x00, 29);
+  } else if (n == 3 && cmd[0] == 0xD9 && cmd[1] == 0xFF && cmd[2] == 0xFF) {
+    b->testmode = false;
+    sim_queue_fill(b, 0x00, 1);
+  } else if (n == 2 && cmd[0] == 0xDA) {
+    sim_queue_fill(b, 0x00, 9);
+  } else if (n == 4 && cmd[0] == 0xD4 && cmd[1] == 0xBA) {
+    const byte rsp[2] = { 0x20, 0x06 };
+    sim_queue(b, rsp, 2);
+  } else if (n == 4 && cmd[0] == 0xD4 && cmd[1] == 0x8D) {
+    sim_queue_fill(b, 0x00, 8);
+  } else if (n == 4 && cmd[0] == 0xD4 && cmd[1] == 0x50) {
+    const byte rsp[3] = { 0x00, 0x10, 0x00 };
+    sim_queue(b, rsp, 3);
+  } else if (n == 34 && cmd[0] == 0x0F && cmd[1] == 0x00) {
+    if (b->testmode) {
+      memcpy(b->scratch, cmd + 2, 32);
+      b->scratch_valid = true;
+    }
+  } else if (n == 2 && cmd[0] == 0x55 && cmd[1] == 0xA5) {
+    if (b->testmode && b->scratch_valid) {
+      memcpy(b->msg, b->scratch, 32);
+      b->busy_until = millis() + SIM_COMMIT_MS;
+    }
+  }
+}
+
+// A healthy 5 Ah pack with the given error nibble
+static void sim_pack_init(SimBattery* b, uint8_t error) {
+  memset(b, 0, sizeof(*b));
+  b->present = true;
+  b->powered = true;
+  memcpy(b->rom, SIM_ROM, 8);
+
+  b->msg[11] = 0x30;  // Type 3
+  b->msg[16] = 0x05;  // 5000 mAh
+  b->msg[24] = 0x02;
+  b->msg[25] = 0x02;
+  b->msg[27] = 0xF7;  // 127 cycles
+  b->msg[20] = error & 0x0F;
+  recalcMsgChecksums(b->msg);
+
+  // Cells in mV at offset 2, temperatures in 0.1 K at offsets 14 and 16
+  sim_put16(b->data + 2, 4012);
+  sim_put16(b->data + 4, 4020);
+  sim_put16(b->data + 6, 4008);
+  sim_put16(b->data + 8, 4015);
+  sim_put16(b->data + 10, 4011);
+  sim_put16(b->data + 14, 2976);
+  sim_put16(b->data + 16, 2990);
+}
+
+#if RACK_SLOTS
+// Rack packs differ from the single one in ROM serial, cycles and charge
+static void sim_rack_init(const char* mask, uint8_t error) {
+  uint8_t fitted = mask ? strtoul(mask, NULL, 16) : (1 << RACK_SLOTS) - 1;
+
+  for (uint8_t i = 0; i < RACK_SLOTS; i++) {
+    SimBattery* b = &sim_rack[i];
+    sim_pack_init(b, error);
+    b->present = (fitted >> i) & 1;
+    b->rom[6] = 0x80 + i;
+    b->msg[27] = 0xF7 - 0x10 * i;
+    recalcMsgChecksums(b->msg);
+    for (uint8_t c = 0; c < 5; c++) sim_put16(b->data + 2 + 2 * c, 3900 - 40 * i + 7 * c);
+  }
+}
+#endif
+
+void hal_init() {
+  const char* chip = getenv("MAKITA_SIM_CHIP");
+  const char* err = getenv("MAKITA_SIM_ERROR");
+  const char* swap = getenv("MAKITA_SIM_SWAP");
+
+  uint8_t error = err ? strtol(err, NULL, 16) : 0;
+
+  sim_pack_init(&sim, error);
+  sim.present = !(chip && strcmp(chip, "none") == 0);
+  sim.mute = chip && strcmp(chip, "mute") == 0;
+  sim_swap_ms = swap ? strtoul(swap, NULL, 10) : 0;
+
+#if RACK_SLOTS
+  sim_rack_init(getenv("MAKITA_SIM_RACK"), error);
+#endif
+}
+
+// Hot-swap bench: odd phases are empty slots, each even one a new pack
+static void sim_swap() {
+  if (!sim_swap_ms) return;
+
+  uint32_t phase = millis() / sim_swap_ms;
+  if (phase == sim_swap_phase) return;
+  sim_swap_phase = phase;
+
+  if (sim.present != !(phase & 1)) sim_edge = sim_watch;
+  sim.present = !(phase & 1);
+  sim.rom[5] = phase / 2;
+  sim.testmode = false;
+  sim.scratch_valid = false;
+  sim.cc_quirk = false;
+  sim.tx_len = 0;
+}
+
+// ============== Bus, per pack ==============
+
+// The callers advance the clock - once per slot, however many packs listen
+
+static bool sim_bus_reset(SimBattery* b) {
+  b->garbled = !sim_timing_ok();
+  if (b->rx_len > 0 && b->rx[0] == 0x33) b->cc_quirk = true;
+  b->rx_len = 0;
+  b->tx_len = 0;
+  b->tx_pos = 0;
+
+  return b->present && b->powered && (int32_t)(millis() - b->busy_until) >= 0;
+}
+
+static void sim_bus_write(SimBattery* b, uint8_t v) {
+  if (!b->present || !b->powered || b->garbled || b->rx_len >= sizeof(b->rx)) return;
+  b->rx[b->rx_len++] = v;
+  sim_process(b);
+}
+
+static uint8_t sim_bus_read(SimBattery* b) {
+  if (b->tx_pos < b->tx_len) return b->tx[b->tx_pos++];
+  return 0xFF;
+}
+
+static void sim_write_slots(uint8_t v) {
+  for (uint8_t mask = 0x01; mask; mask <<= 1) {
+    delayMicroseconds((v & mask) ? timing.w1_low + timing.w1_high : timing.w0_low + timing.w0_high);
+  }
+}
+
+static void sim_read_slots() {
+  delayMicroseconds(8 * (timing.r_low + timing.r_sample + timing.r_tail));
+}
+
+// ============== Bus ==============
+
+bool hal_reset() {
+  hal_reset_count++;
+  sim_swap();
+  delayMicroseconds(timing.reset_low + timing.reset_sample + timing.reset_tail);
+  return sim_bus_reset(&sim);
+}
+
+void hal_write(uint8_t v) {
+  hal_tx_bytes++;
+  sim_write_slots(v);
+  sim_bus_write(&sim, v);
+}
+
+void hal_write_bytes(const uint8_t* buf, uint16_t count) {
+  for (uint16_t i = 0; i < count; i++) hal_write(buf[i]);
+}
+
+uint8_t hal_read() {
+  hal_rx_bytes++;
+  sim_read_slots();
+  return sim_bus_read(&sim);
+}
+
+void hal_read_bytes(uint8_t* buf, uint16_t count) {
+  for (uint16_t i = 0; i < count; i++) buf[i] = hal_read();
+}
+
+bool hal_seg_dead(const HalSegment* seg) {
+  if (seg->read != HAL_SEG_PROBE || !seg->len) return false;
+  for (uint8_t i = 0; i < seg->len; i++) {
+    if (seg->buf[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+// Transfers complete synchronously; the simulator has no background engine
+static uint8_t xfer_status;
+static uint32_t xfer_cycles;
+
+bool hal_transfer_start(const HalSegment* segs, uint8_t count, uint16_t gap_us) {
+  uint32_t t0 = micros();
+
+  xfer_status = HAL_NO_PRESENCE;
+  if (hal_reset()) {
+    delayMicroseconds(gap_us);
+    xfer_status = HAL_OK;
+    for (uint8_t i = 0; i < count; i++) {
+      if (segs[i].read) hal_read_bytes(segs[i].buf, segs[i].len);
+      else hal_write_bytes(segs[i].buf, segs[i].len);
+      if (hal_seg_dead(&segs[i])) {
+        xfer_status = HAL_NO_ANSWER;
+        break;
+      }
+    }
+  }
+  xfer_cycles = (micros() - t0) * 16;  // 16 MHz board
+  return true;
+}
+
+bool hal_transfer_busy() { return false; }
+uint8_t hal_transfer_status() { return xfer_status; }
+uint32_t hal_transfer_cpu_cycles() { return xfer_cycles; }
+
+// Inserting or pulling a pack is the only edge the simulator reports
+void hal_watch_line(bool on) {
+  sim_watch = on;
+  sim_edge = false;
+}
+
+bool hal_line_changed() {
+  sim_swap();
+  bool changed = sim_edge;
+  sim_edge = false;
+  return changed;
+}
+
+// Serial polls advance the virtual clock by themselves
+void hal_idle() {}
+
+void hal_get_timing(HalTiming* t) { *t = timing; }
+void hal_set_timing(const HalTiming* t) { timing = *t; }
+void hal_default_timing(HalTiming* t) { *t = SIM_DEFAULT_TIMING; }
+
+static void sim_power(SimBattery* b, bool high) {
+  if (high && !b->powered) {
+    b->testmode = false;
+    b->scratch_valid = false;
+    b->cc_quirk = false;
+  }
+  b->powered = high;
+}
+
+void hal_set_enable(bool high) {
+  sim_power(&sim, high);
+}
+
+
+// ============== Rack ==============
+
+#if RACK_SLOTS
+
+// A slot is written and read in the same bus time as the single pack - all
+// slots share each bit slot
+
+void hal_rack_init() {}
+
+uint8_t hal_rack_reset(uint8_t slots) {
+  uint8_t present = 0;
+
+  hal_reset_count++;
+  delayMicroseconds(timing.reset_low + timing.reset_sample + timing.reset_tail);
+  for (uint8_t i = 0; i < RACK_SLOTS; i++) {
+    if (((slots >> i) & 1) && sim_bus_reset(&sim_rack[i])) present |= 1 << i;
+  }
+  return present;
+}
+
+void hal_rack_write_bytes(const uint8_t* buf, uint8_t count, uint8_t slots, uint8_t stride) {
+  hal_tx_bytes += count;
+  for (uint8_t n = 0; n < count; n++) {
+    sim_write_slots(buf[n]);
+    for (uint8_t i = 0; i < RACK_SLOTS; i++) {
+      if ((slots >> i) & 1) sim_bus_write(&sim_rack[i], buf[i * stride + n]);
+    }
+  }
+}
+
+void hal_rack_read_bytes(uint8_t* buf, uint8_t count, uint8_t slots, uint8_t stride) {
+  hal_rx_bytes += count;
+  for (uint8_t n = 0; n < count; n++) {
+    sim_read_slots();
+    for (uint8_t i = 0; i < RACK_SLOTS; i++) {
+      if ((slots >> i) & 1) buf[i * stride + n] = sim_bus_read(&sim_rack[i]);
+    }
+  }
+}
+
+void hal_rack_set_enable(uint8_t slots) {
+  for (uint8_t i = 0; i < RACK_SLOTS; i++) sim_power(&sim_rack[i], (slots >> i) & 1);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,354 @@
+/*
+ * Makita Battery Reader - Binary Host Protocol
+ */
+
+#include "makita_host.h"
+#include "makita_chip.h"
+#include "makita_commands.h"
+#include "makita_data.h"
+#include "makita_stats.h"
+#include "makita_stream.h"
+#include "makita_task.h"
+
+#if defined(__AVR__)
+#include <util/crc16.h>
+#endif
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+// cell_count | cell_mv[10] | diff_mv | pack_mv | t_cell | t_mosfet
+#define TELEMETRY_PAYLOAD_LEN (1 + 2 * 10 + 2 * 4)
+#define BATTERY_PAYLOAD_LEN   (8 + 32 + 1 + TELEMETRY_PAYLOAD_LEN)
+
+static uint16_t tx_crc;
+
+// Rates with the UART divider used by the core (U2X): all but 115200 are
+// exact at 16 MHz, 115200 runs at 117647 (+2.1%), which USB bridges accept
+static const uint32_t host_rates[] PROGMEM = { 9600, 115200, 250000, 500000, 1000000 };
+
+static uint32_t host_baud = HOST_BAUD_DEFAULT;
+static uint32_t host_bytes_per_s;
+
+static uint16_t crc16_update(uint16_t crc, byte b) {
+#if defined(__AVR__)
+  return _crc_xmodem_update(crc, b);
+#else
+  crc ^= (uint16_t)b << 8;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+#endif
+}
+
+// ============== Response framing ==============
+
+void hostBegin(byte cmd, byte status, byte len) {
+  byte hdr[2] = { (byte)(len + 1), (byte)(cmd | HOST_RSP_FLAG) };
+  tx_crc = 0xFFFF;
+  Serial.write(HOST_SOF);
+  hostWrite(hdr, 2);
+  hostWrite(&status, 1);
+}
+
+void hostWrite(const byte* data, byte len) {
+  for (byte i = 0; i < len; i++) {
+    tx_crc = crc16_update(tx_crc, data[i]);
+  }
+  Serial.write(data, len);
+}
+
+void hostEnd() {
+  Serial.write((byte)(tx_crc & 0xFF));
+  Serial.write((byte)(tx_crc >> 8));
+}
+
+static void hostReply(byte cmd, byte status) {
+  hostBegin(cmd, status, 0);
+  hostEnd();
+}
+
+// Field by field, so the layout doesn't depend on struct padding
+static void hostWriteTelemetry(const Telemetry* tm) {
+  hostWrite(&tm->cell_count, 1);
+  hostWrite((const byte*)tm->cell_mv, sizeof(tm->cell_mv));
+  hostWrite((const byte*)&tm->diff_mv, 2);
+  hostWrite((const byte*)&tm->pack_mv, 2);
+  hostWrite((const byte*)&tm->t_cell, 2);
+  hostWrite((const byte*)&tm->t_mosfet, 2);
+}
+
+static void hostSendBattery(byte cmd) {
+  byte flags = (g_battery.valid ? 0x01 : 0) | (g_battery.chip == CHIP_BL36 ? 0x02 : 0) |
+               (g_battery.chip == CHIP_F0513 ? 0x04 : 0);
+
+  hostBegin(cmd, HOST_OK, BATTERY_PAYLOAD_LEN);
+  hostWrite(g_battery.rom, 8);
+  hostWrite(g_battery.msg, 32);
+  hostWrite(&flags, 1);
+  hostWriteTelemetry(&g_battery.tm);
+  hostEnd();
+}
+
+// ============== Frame reception ==============
+
+// Read one byte with timeout, returns -1 on timeout
+static int hostReadByte() {
+  uint32_t start = millis();
+  while (!Serial.available()) {
+    if (millis() - start > HOST_BYTE_TIMEOUT_MS) return -1;
+  }
+  return Serial.read();
+}
+
+// Rest of a frame after SOF; cmd is 0x7F if the header timed out
+static byte hostReceive(byte* cmd, byte* payload, byte* len) {
+  uint16_t crc = 0xFFFF;
+
+  *cmd = 0x7F;
+  int n = hostReadByte();
+  int c = hostReadByte();
+  if (n < 0 || c < 0) return HOST_ERR_TIMEOUT;
+  *cmd = c;
+  if (n > HOST_MAX_RX_PAYLOAD) {
+    while (hostReadByte() >= 0) {}  // Drop the rest of the frame
+    return HOST_ERR_LENGTH;
+  }
+
+  crc = crc16_update(crc, n);
+  crc = crc16_update(crc, c);
+  for (int i = 0; i < n; i++) {
+    int b = hostReadByte();
+    if (b < 0) return HOST_ERR_TIMEOUT;
+    payload[i] = b;
+    crc = crc16_update(crc, b);
+  }
+
+  int lo = hostReadByte();
+  int hi = hostReadByte();
+  if (lo < 0 || hi < 0) return HOST_ERR_TIMEOUT;
+  if ((uint16_t)(lo | (hi << 8)) != crc) return HOST_ERR_CRC;
+
+  *len = n;
+  return HOST_OK;
+}
+
+// ============== Baud rate ==============
+
+static uint32_t get_u32(const byte* p) {
+  return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool baud_supported(uint32_t baud) {
+  for (uint8_t i = 0; i < sizeof(host_rates) / sizeof(host_rates[0]); i++) {
+    if (pgm_read_dword(&host_rates[i]) == baud) return true;
+  }
+  return false;
+}
+
+// Rate the UART really runs at: UBRR rounded down as in HardwareSerial::begin()
+static uint32_t baud_actual(uint32_t baud) {
+  uint16_t ubrr = (F_CPU / 4 / baud - 1) / 2;
+  return F_CPU / 8 / (ubrr + 1);
+}
+
+static void baud_set(uint32_t baud) {
+  Serial.flush();  // Last reply out at the old rate
+  Serial.end();
+  Serial.begin(baud);
+  host_baud = baud;
+}
+
+// Confirmation frame at the new rate; stray bytes from the switch are skipped
+static bool baud_confirmed(uint32_t baud) {
+  byte payload[HOST_MAX_RX_PAYLOAD];
+  byte cmd, len;
+  uint32_t start = millis();
+
+  while (millis() - start < HOST_BAUD_CONFIRM_MS) {
+    if (!Serial.available()) {
+      delay(1);
+      continue;
+    }
+    if (Serial.read() != HOST_SOF) continue;
+    if (hostReceive(&cmd, payload, &len) == HOST_OK && cmd == HOST_CMD_BAUD &&
+        len == 4 && get_u32(payload) == baud) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Echo with a test pattern, timed until the last stop bit has left
+static void baud_echo(uint32_t baud) {
+  uint32_t actual = baud_actual(baud);
+  uint32_t t0 = micros();
+
+  hostBegin(HOST_CMD_BAUD, HOST_OK, 8 + HOST_BAUD_PATTERN);
+  hostWrite((const byte*)&baud, 4);
+  hostWrite((const byte*)&actual, 4);
+  for (uint8_t i = 0; i < HOST_BAUD_PATTERN; i++) {
+    byte b = (i & 1) ? 0xAA : 0x55;
+    hostWrite(&b, 1);
+  }
+  hostEnd();
+  Serial.flush();
+
+  // SOF, LEN, CMD, status, payload, CRC
+  uint32_t us = micros() - t0;
+  uint32_t bytes = 4 + 8 + HOST_BAUD_PATTERN + 2;
+  host_bytes_per_s = us ? bytes * 1000000UL / us : 0;
+}
+
+static void hostBaud(const byte* payload, byte len) {
+  if (len == 0) {
+    uint32_t info[3] = { host_baud, baud_actual(host_baud), host_bytes_per_s };
+    hostBegin(HOST_CMD_BAUD, HOST_OK, sizeof(info));
+    hostWrite((const byte*)info, sizeof(info));
+    hostEnd();
+    return;
+  }
+  if (len != 4) {
+    hostReply(HOST_CMD_BAUD, HOST_ERR_LENGTH);
+    return;
+  }
+
+  uint32_t baud = get_u32(payload);
+  if (!baud_supported(baud)) {
+    hostReply(HOST_CMD_BAUD, HOST_ERR_VALUE);
+    return;
+  }
+
+  uint32_t actual = baud_actual(baud);
+  hostBegin(HOST_CMD_BAUD, HOST_OK, 4);
+  hostWrite((const byte*)&actual, 4);
+  hostEnd();
+
+  baud_set(baud);
+  if (baud_confirmed(baud)) {
+    baud_echo(baud);
+    return;
+  }
+
+  host_bytes_per_s = 0;
+  baud_set(HOST_BAUD_DEFAULT);
+  hostReply(HOST_CMD_BAUD, HOST_ERR_TIMEOUT);
+}
+
+// ============== Dispatch ==============
+
+static void hostDispatch(byte cmd, const byte* payload, byte len) {
+  if (taskBusy() && cmd != HOST_CMD_PING && cmd != HOST_CMD_CACHED &&
+      !(cmd == HOST_CMD_STREAM && streamActive()) && !(cmd == HOST_CMD_BAUD && len == 0)) {
+    hostReply(cmd, HOST_ERR_BUSY);
+    return;
+  }
+
+  switch (cmd) {
+    case HOST_CMD_PING: {
+      byte ver = HOST_PROTO_VERSION;
+      hostBegin(cmd, HOST_OK, 1);
+      hostWrite(&ver, 1);
+      hostEnd();
+      break;
+    }
+
+    case HOST_CMD_READ_ALL:
+      if (!readAllBatteryData()) {
+        hostReply(cmd, HOST_ERR_NO_BATTERY);
+        break;
+      }
+      hostSendBattery(cmd);
+      break;
+
+    case HOST_CMD_CACHED:
+      hostSendBattery(cmd);
+      break;
+
+    case HOST_CMD_ROM_MSG:
+      memset(g_buf, 0, 40);
+      if (!try_charger(g_buf)) {
+        hostReply(cmd, HOST_ERR_NO_BATTERY);
+        break;
+      }
+      hostBegin(cmd, HOST_OK, 40);
+      hostWrite(g_buf, 40);
+      hostEnd();
+      break;
+
+    case HOST_CMD_VOLTAGES: {
+      Telemetry tm;
+      if (!chip_telemetry(&tm)) {
+        hostReply(cmd, HOST_ERR_NO_BATTERY);
+        break;
+      }
+      hostBegin(cmd, HOST_OK, TELEMETRY_PAYLOAD_LEN);
+      hostWriteTelemetry(&tm);
+      hostEnd();
+      break;
+    }
+
+    case HOST_CMD_LOCK_STATUS: {
+      byte locked = isBatteryLocked() ? 1 : 0;
+      hostBegin(cmd, HOST_OK, 1);
+      hostWrite(&locked, 1);
+      hostEnd();
+      break;
+    }
+
+    case HOST_CMD_STREAM:
+      if (len == 0) {
+        // Summary frame follows when the stream task ends
+        if (!streamActive()) hostReply(cmd, HOST_OK);
+        streamStop();
+      } else if (len != 2) {
+        hostReply(cmd, HOST_ERR_LENGTH);
+      } else if (!streamStart(payload[0] | (payload[1] << 8), STREAM_HOST)) {
+        hostReply(cmd, HOST_ERR_BUSY);
+      } else {
+        hostReply(cmd, HOST_OK);
+      }
+      break;
+
+    case HOST_CMD_STATS:
+      if (len > 1) {
+        hostReply(cmd, HOST_ERR_LENGTH);
+        break;
+      }
+      stats_send(cmd);
+      if (len == 1 && payload[0] == 1) stats_reset();
+      break;
+
+    case HOST_CMD_BAUD:
+      hostBaud(payload, len);
+      break;
+
+    case HOST_CMD_RESET_ERR:
+      // Same sequence as resetBatteryErrors(), without text output
+      for (int i = 0; i < 3; i++) {
+        delay(300);
+        testmode_cmd();
+        reset_error_cmd();
+      }
+      hostReply(cmd, HOST_OK);
+      break;
+
+    default:
+      hostReply(cmd, HOST_ERR_UNKNOWN);
+      break;
+  }
+}
+
+void hostHandleFrame() {
+  byte payload[HOST_MAX_RX_PAYLOAD];
+  byte cmd, len;
+
+  byte status = hostReceive(&cmd, payload, &len);
+  if (status != HOST_OK) {
+    hostReply(cmd, status);
+    return;
+  }
+  hostDispatch(cmd, payload, len);
+}
@@ -0,0 +1,86 @@
+/*
+ * Makita Battery Reader - Binary Host Protocol
+ *
+ * Frame layout (both directions):
+ *   SOF | LEN | CMD | PAYLOAD[LEN] | CRC16 lo | CRC16 hi
+ *
+ * CRC-16/CCITT (poly 0x1021, init 0xFFFF) covers LEN, CMD and PAYLOAD.
+ * Responses echo CMD with bit 7 set; the first payload byte is a status code.
+ * SOF is not a printable character, so the text menu and the binary protocol
+ * share the same serial port.
+ */
+
+#ifndef MAKITA_HOST_H
+#define MAKITA_HOST_H
+
+#include "config.h"
+
+#define HOST_SOF             0xA5
+#define HOST_PROTO_VERSION   2
+#define HOST_MAX_RX_PAYLOAD  16
+#define HOST_BYTE_TIMEOUT_MS 50
+#define HOST_RSP_FLAG        0x80
+
+#define HOST_BAUD_DEFAULT    9600  // Rate after reset and after a failed switch
+#define HOST_BAUD_CONFIRM_MS 1000  // Wait for the confirmation at the new rate
+#define HOST_BAUD_PATTERN    64    // Test bytes in the confirmation echo
+
+// Commands
+#define HOST_CMD_PING        0x01  // -> version
+#define HOST_CMD_READ_ALL    0x10  // -> battery data (fresh read)
+#define HOST_CMD_CACHED      0x11  // -> battery data (cached, no bus traffic)
+#define HOST_CMD_ROM_MSG     0x12  // -> rom[8] msg[32]
+#define HOST_CMD_VOLTAGES    0x13  // -> telemetry (same layout as in battery data)
+#define HOST_CMD_LOCK_STATUS 0x14  // -> locked (0/1)
+#define HOST_CMD_STREAM      0x15  // interval_ms (u16) starts, empty payload stops
+#define HOST_CMD_STATS       0x16  // -> bus statistics; payload 0x01 also resets them
+#define HOST_CMD_BAUD        0x17  // rate (u32) switches the port, empty payload -> rate info
+#define HOST_CMD_RESET_ERR   0x20  // quick error reset, no payload
+
+// Unsolicited frames (sent with HOST_RSP_FLAG like responses)
+#define HOST_EVT_STREAM      0x40  // One stream record
+
+// Status codes
+#define HOST_OK              0x00
+#define HOST_ERR_CRC         0x01
+#define HOST_ERR_LENGTH      0x02
+#define HOST_ERR_UNKNOWN     0x03
+#define HOST_ERR_TIMEOUT     0x04
+#define HOST_ERR_NO_BATTERY  0x05
+#define HOST_ERR_BUSY        0x06  // Background operation owns the bus
+#define HOST_ERR_VALUE       0x07  // Unsupported parameter value
+
+// Battery data payload (little-endian):
+//   rom[8] | msg[32] | flags (bit0=valid, bit1=bl36, bit2=f0513) | telemetry
+// Telemetry:
+//   cell_count | cell_mv[10] (u16) | diff_mv (u16) | pack_mv (u16) | t_cell | t_mosfet
+//   (int16, 0.1 C, 0x8000 = not available)
+
+// Stream record payload (after status, little-endian):
+//   seq (u16) | t_ms (u32) | cell_count | mv[cell_count] (u16) | t_cell | t_mosfet
+//   (int16, 0.1 C, 0x8000 = not available)
+// Stream stop response: samples (u32) | dropped (u32) | elapsed_ms (u32)
+
+// Statistics payload (little-endian):
+//   resets | presence_fail | no_answer | garbage | power_cycles | commands | retries |
+//   timeouts (u16 each) | tx_bytes (u32) | rx_bytes (u32) | n |
+//   n x (initial, op0, op1, count[8] (u16), buckets < 2, 4, .. 128, >= 128 ms)
+
+// Baud rate switch:
+//   1. Host sends BAUD rate (u32); the reply (actual rate, u32) comes at the old rate.
+//   2. Both sides switch. Within HOST_BAUD_CONFIRM_MS the host repeats the same
+//      frame at the new rate; the echo is rate | actual | pattern[HOST_BAUD_PATTERN]
+//      (0x55, 0xAA, ...). Anything else, or nothing, and the port goes back to
+//      HOST_BAUD_DEFAULT with a timeout reply there.
+//   BAUD with no payload -> rate | actual | bytes_per_s (u32 each), the throughput
+//   measured on the last echo (0 = not measured).
+
+// Handle one frame; called by loop() after it has consumed HOST_SOF
+void hostHandleFrame();
+
+// Response framing - usable by other modules that stream frames to the host
+void hostBegin(byte cmd, byte status, byte len);
+void hostWrite(const byte* data, byte len);
+void hostEnd();
+
+#endif
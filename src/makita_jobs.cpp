@@ -0,0 +1,510 @@
+/*
+ * Makita Battery Reader - Rack Job Scheduler
+ */
+
+#include "makita_jobs.h"
+
+#if RACK_SLOTS
+
+#include "makita_comm.h"
+#include "makita_commands.h"
+#include "makita_msg.h"
+#include "makita_print.h"
+#include "makita_rack.h"
+#include "makita_strategy.h"
+#include "makita_task.h"
+#include "makita_timing.h"
+#include "makita_unlock.h"
+
+#define RACK_ALL ((uint8_t)((1 << RACK_SLOTS) - 1))
+
+// Job results
+#define JOB_OK     0
+#define JOB_FAILED 1  // Pack not read, or MSG not written
+#define JOB_LOCKED 2  // Every unlock strategy tried
+#define JOB_NO_MSG 3  // Clone without a saved MSG
+
+// Per-slot state - everything a job needs across sleeps lives here
+struct RackWorker {
+  Task task;       // Running job
+  Task child;      // Its MSG write
+  uint8_t queue[RACK_QUEUE];
+  uint8_t queued;
+  uint8_t job;     // RACK_JOB_*, RACK_JOB_NONE = idle
+  uint8_t result;  // JOB_*
+  bool written;    // Last MSG write read back equal
+  // Unlock
+  uint8_t error;   // Statistics key, with UNLOCK_CHIP_RACK
+  uint8_t order[UNLOCK_STRATEGIES];
+  uint8_t pos;     // Strategy in order
+  uint8_t n;       // Test mode / reset pair
+  uint32_t strat_t0;
+  // Accounting
+  uint32_t t0;     // Job start
+  uint32_t bus_us; // Time the job spent in its steps - bus transactions
+};
+
+static RackWorker workers[RACK_SLOTS];
+
+static Task jobs_task;
+static bool jobs_running = false;
+static bool jobs_stop = false;
+
+static uint32_t jobs_t0;
+static uint16_t jobs_done;
+static uint16_t jobs_ok;
+static uint32_t jobs_sum_ms;  // Job wall times added up
+static uint32_t jobs_bus_ms;
+static uint8_t jobs_timing;   // Single pack timing, back after the run
+
+static inline uint8_t worker_slot(const RackWorker* w) {
+  return w - workers;
+}
+
+// ============== Slot commands ==============
+
+static bool job_read_msg(uint8_t slot, byte* msg) {
+  byte cmd[] = { 0xF0, 0x00 };
+  return rack_slot_cmd(slot, 0x33, cmd, 2, msg, 32) == BUS_OK;
+}
+
+// Current MSG into the slot's record; false if it could not be read.
+// locked tells whether the MSG keeps the charger from charging.
+static bool job_read_lock(uint8_t slot, bool* locked) {
+  RackSlot* s = &g_rack[slot];
+  byte cmd[] = { 0xF0, 0x00 };
+
+  s->status = rack_slot_cmd(slot, 0x33, cmd, 2, s->msg, 32);
+  if (s->status != BUS_OK) return false;
+
+  ConstMsgView msg(s->msg);
+  *locked = msg.errorLocks() || !msg.checksumsOk();
+  return true;
+}
+
+static void job_testmode(uint8_t slot) {
+  byte cmd[] = { 0xD9, 0x96, 0xA5 };
+  rack_slot_cmd(slot, 0x33, cmd, 3, g_buf, 29);
+}
+
+static void job_exit_testmode(uint8_t slot) {
+  byte cmd[] = { 0xD9, 0xFF, 0xFF };
+  rack_slot_cmd(slot, 0x33, cmd, 3, g_buf, 1);
+}
+
+static void job_reset_error(uint8_t slot) {
+  byte cmd[] = { 0xDA, 0x04 };
+  rack_slot_cmd(slot, 0x33, cmd, 2, g_buf, 9);
+}
+
+// Strategy and step of a running unlock, fetched again after every sleep
+static const UnlockStrategy* job_strategy(const RackWorker* w, UnlockStrategy* st) {
+  strategy_get(w->order[w->pos], st);
+  return st;
+}
+
+static const UnlockStep* job_step(const RackWorker* w, const Task* t, UnlockStep* step) {
+  UnlockStrategy st;
+  strategy_step(job_strategy(w, &st)->first + t->j, step);
+  return step;
+}
+
+// ============== Job tasks ==============
+
+// write_msg_task for one slot: the MSG in g_rack[slot].msg is written in
+// test mode, read back after the commit and written again after a power
+// cycle while it differs. Skipped if the pack already holds it.
+static uint8_t jobWriteTask(Task* t) {
+  RackWorker* w = (RackWorker*)t->arg;
+  uint8_t slot = worker_slot(w);
+  byte commit[] = { 0x55, 0xA5 };
+
+  TASK_BEGIN(t);
+  w->written = job_read_msg(slot, g_buf) && memcmp(g_buf, g_rack[slot].msg, 32) == 0;
+  if (w->written) TASK_EXIT(t);
+
+  for (t->j = 0; t->j < MSG_WRITE_TRIES; t->j++) {
+    job_testmode(slot);
+    if (rack_slot_store(slot, g_rack[slot].msg) == BUS_OK &&
+        rack_slot_cmd(slot, 0x33, commit, 2, NULL, 0) == BUS_OK) {
+      // The chip does not answer while it programs - poll until it does
+      for (t->i = 0; t->i < COMMIT_TIMEOUT_MS / COMMIT_POLL_MS; t->i++) {
+        TASK_SLEEP(t, COMMIT_POLL_MS);
+        if (rack_slot_cmd(slot, 0x33, NULL, 0, NULL, 0) == BUS_OK) break;
+      }
+      job_exit_testmode(slot);
+
+      w->written = job_read_msg(slot, g_buf) && memcmp(g_buf, g_rack[slot].msg, 32) == 0;
+      if (w->written) TASK_EXIT(t);
+    }
+
+    rack_set_power(1 << slot, false);
+    TASK_SLEEP(t, TRIGGER_POWER_OFF_MS);
+    rack_set_power(1 << slot, true);
+    TASK_SLEEP(t, TRIGGER_POWER_MS - TRIGGER_POWER_OFF_MS);
+  }
+
+  // Not written - keep what the pack really holds
+  job_read_msg(slot, g_rack[slot].msg);
+  TASK_END(t);
+}
+
+static uint8_t jobTask(Task* t) {
+  RackWorker* w = (RackWorker*)t->arg;
+  uint8_t slot = worker_slot(w);
+  UnlockStrategy st;
+  UnlockStep step;
+  bool locked;
+
+  TASK_BEGIN(t);
+
+  // Every job starts from a freshly powered pack
+  rack_set_power(1 << slot, false);
+  TASK_SLEEP(t, TRIGGER_POWER_OFF_MS);
+  rack_set_power(1 << slot, true);
+  TASK_SLEEP(t, JOB_SETTLE_MS);
+
+  // ROM, MSG and cells - all a read job does
+  for (t->i = 0; !rack_read_slots(1 << slot); t->i++) {
+    if (t->i == RACK_TRIES - 1) TASK_EXIT(t);
+    TASK_SLEEP(t, JOB_RETRY_MS);
+  }
+  w->result = JOB_OK;
+
+  if (w->job == RACK_JOB_CLONE || w->job == RACK_JOB_CYCLES) {
+    if (w->job == RACK_JOB_CLONE) {
+      if (!savedMSG()) {
+        w->result = JOB_NO_MSG;
+        TASK_EXIT(t);
+      }
+      memcpy(g_rack[slot].msg, savedMSG(), 32);
+      MsgView(g_rack[slot].msg).set(MSG_ERROR, MSG_ERR_OK);
+    } else {
+      MsgView(g_rack[slot].msg).set(MSG_CYCLES, 0);
+    }
+    recalcMsgChecksums(g_rack[slot].msg);
+
+    TASK_AWAIT(t, &w->child, jobWriteTask, w);
+    if (!w->written) w->result = JOB_FAILED;
+  } else if (w->job == RACK_JOB_UNLOCK) {
+    // Strategies in the order learned for rack packs with this error code;
+    // only packs locked to begin with are worth recording. The family is
+    // not probed on a slot, so rack runs are kept apart from the single
+    // pack's statistics.
+    if (!job_read_lock(slot, &locked)) {
+      w->result = JOB_FAILED;
+      TASK_EXIT(t);
+    }
+    if (!locked) TASK_EXIT(t);
+    w->error = ConstMsgView(g_rack[slot].msg).get(MSG_ERROR);
+    strategy_order(UNLOCK_CHIP_RACK, w->error, w->order);
+
+    for (w->pos = 0; w->pos < UNLOCK_STRATEGIES; w->pos++) {
+      w->strat_t0 = millis();
+
+      for (t->i = 0; t->i < job_strategy(w, &st)->repeat; t->i++) {
+        for (t->j = 0; t->j < job_strategy(w, &st)->steps; t->j++) {
+          // No switch here - the task macros are case labels
+          if (job_step(w, t, &step)->op == STEP_POWER) {
+            rack_set_power(1 << slot, false);
+            TASK_SLEEP(t, step.a_ms);
+            rack_set_power(1 << slot, true);
+            TASK_SLEEP(t, job_step(w, t, &step)->b_ms);
+          } else if (step.op == STEP_RESETS) {
+            for (w->n = 0; w->n < job_step(w, t, &step)->count; w->n++) {
+              TASK_SLEEP(t, step.a_ms);
+              job_testmode(slot);
+              if (job_step(w, t, &step)->b_ms) TASK_SLEEP(t, step.b_ms);
+              job_reset_error(slot);
+            }
+          } else if (step.op == STEP_WRITE && job_read_msg(slot, g_rack[slot].msg)) {
+            MsgView(g_rack[slot].msg).set(MSG_ERROR, MSG_ERR_OK);
+            recalcMsgChecksums(g_rack[slot].msg);
+            TASK_AWAIT(t, &w->child, jobWriteTask, w);
+          }
+        }
+
+        // An unreadable pack says nothing about the strategy - not recorded
+        if (!job_read_lock(slot, &locked)) {
+          w->result = JOB_FAILED;
+          TASK_EXIT(t);
+        }
+        if (!locked) {
+          strategy_record(UNLOCK_CHIP_RACK, w->error, w->order[w->pos], true, millis() - w->strat_t0);
+          TASK_EXIT(t);
+        }
+      }
+      strategy_record(UNLOCK_CHIP_RACK, w->error, w->order[w->pos], false, 0);
+    }
+    w->result = JOB_LOCKED;
+  }
+
+  TASK_END(t);
+}
+
+// ============== Output ==============
+
+static void printJobName(uint8_t job) {
+  switch (job) {
+    case RACK_JOB_READ:   Serial.print(F("read")); break;
+    case RACK_JOB_UNLOCK: Serial.print(F("unlock")); break;
+    case RACK_JOB_CLONE:  Serial.print(F("clone")); break;
+    case RACK_JOB_CYCLES: Serial.print(F("cycles")); break;
+  }
+}
+
+static void printJobResult(uint8_t result) {
+  switch (result) {
+    case JOB_OK:     Serial.print(F("ok")); break;
+    case JOB_FAILED: Serial.print(F("failed")); break;
+    case JOB_LOCKED: Serial.print(F("locked")); break;
+    case JOB_NO_MSG: Serial.print(F("no saved MSG")); break;
+  }
+}
+
+// slot,job,result,ms,bus_ms,rom,cycles,error,locked - the pack after the job
+static void job_record(const RackWorker* w, uint32_t ms) {
+  const RackSlot* s = &g_rack[worker_slot(w)];
+
+  Serial.print(worker_slot(w));
+  Serial.print(',');
+  printJobName(w->job);
+  Serial.print(',');
+  printJobResult(w->result);
+  printCell(ms);
+  printCell(w->bus_us / 1000);
+  Serial.print(',');
+  if (s->status == BUS_OK) {
+    printPackCells(s->rom, s->msg);
+  } else {
+    Serial.print(F(",,,"));
+  }
+  Serial.println();
+}
+
+static void jobs_summary() {
+  uint32_t elapsed = millis() - jobs_t0;
+
+  Serial.print(F("# "));
+  Serial.print(jobs_done);
+  Serial.print(F(" jobs ("));
+  Serial.print(jobs_ok);
+  Serial.print(F(" ok) in "));
+  printFixed(elapsed / 100, 1);
+  Serial.print(F(" s, "));
+  printFixed(elapsed ? (uint64_t)jobs_done * 36000000 / elapsed : 0, 1);
+  Serial.println(F(" jobs/h"));
+
+  // Job time over wall time: how many jobs ran side by side on average
+  Serial.print(F("# Job time "));
+  printFixed(jobs_sum_ms / 100, 1);
+  Serial.print(F(" s, overlap "));
+  printFixed(elapsed ? (uint64_t)jobs_sum_ms * 10 / elapsed : 0, 1);
+  Serial.print(F("x, bus busy "));
+  printFixed(elapsed ? (uint64_t)jobs_bus_ms * 100 / elapsed : 0, 0);
+  Serial.println('%');
+}
+
+// ============== Scheduler ==============
+
+// Jobs running are dropped where they are, queued ones forgotten
+static void jobs_clear() {
+  for (uint8_t s = 0; s < RACK_SLOTS; s++) {
+    workers[s].job = RACK_JOB_NONE;
+    workers[s].queued = 0;
+  }
+}
+
+static void job_begin(RackWorker* w) {
+  w->job = w->queue[0];
+  w->queued--;
+  memmove(w->queue, w->queue + 1, w->queued);
+
+  w->result = JOB_FAILED;
+  w->t0 = millis();
+  w->bus_us = 0;
+  taskInit(&w->task, jobTask, w);
+}
+
+static void job_end(RackWorker* w) {
+  uint32_t ms = millis() - w->t0;
+
+  job_record(w, ms);
+  jobs_done++;
+  if (w->result == JOB_OK) jobs_ok++;
+  jobs_sum_ms += ms;
+  jobs_bus_ms += w->bus_us / 1000;
+  w->job = RACK_JOB_NONE;
+}
+
+// Step every slot that is due and start queued jobs on idle ones. Returns
+// false once nothing is left; next is the earliest deadline.
+static bool jobs_step(uint32_t* next) {
+  bool busy = false;
+
+  *next = millis() + 1000;
+  for (uint8_t s = 0; s < RACK_SLOTS; s++) {
+    RackWorker* w = &workers[s];
+
+    if (w->job != RACK_JOB_NONE && (int32_t)(millis() - w->task.wake) >= 0) {
+      uint32_t us = micros();
+      uint8_t r = w->task.fn(&w->task);
+      w->bus_us += micros() - us;
+      if (r != TASK_WAITING) job_end(w);
+    }
+    if (w->job == RACK_JOB_NONE) {
+      if (!w->queued) continue;
+      job_begin(w);
+    }
+
+    busy = true;
+    if ((int32_t)(w->task.wake - *next) < 0) *next = w->task.wake;
+  }
+  return busy;
+}
+
+static uint8_t rackJobsTask(Task* t) {
+  uint32_t next;
+
+  TASK_BEGIN(t);
+
+  Serial.println(F("# Rack jobs - 'x' stops"));
+  Serial.println(F("# slot,job,result,ms,bus_ms,rom,cycles,error,locked"));
+  jobs_t0 = millis();
+
+  while (!jobs_stop && jobs_step(&next)) {
+    TASK_SLEEP_UNTIL(t, next);
+  }
+
+  jobs_clear();
+  rack_set_power(RACK_ALL, true);
+  timing_apply(jobs_timing);
+
+  jobs_summary();
+  jobs_running = false;
+  TASK_END(t);
+}
+
+bool rackQueue(uint8_t slot, uint8_t job) {
+  if (slot >= RACK_SLOTS || job == RACK_JOB_NONE || job > RACK_JOB_CYCLES) return false;
+
+  RackWorker* w = &workers[slot];
+  if (w->queued >= RACK_QUEUE) return false;
+  w->queue[w->queued++] = job;
+  return true;
+}
+
+bool rackJobsStart() {
+  if (jobs_running) return false;
+
+  jobs_stop = false;
+  jobs_done = 0;
+  jobs_ok = 0;
+  jobs_sum_ms = 0;
+  jobs_bus_ms = 0;
+
+  // Rack packs are not calibrated - the shared slot timings go to default
+  jobs_timing = timing_percent();
+  if (!taskStart(&jobs_task, rackJobsTask, NULL)) return false;
+  timing_apply(TIMING_DEFAULT);
+  jobs_running = true;
+  return true;
+}
+
+void rackJobsStop() {
+  if (!jobs_running) return;
+  jobs_stop = true;
+  jobs_task.wake = millis();
+}
+
+bool rackJobsActive() {
+  return jobs_running;
+}
+
+// ============== Menu ==============
+
+static uint8_t job_letter(char c) {
+  switch (c) {
+    case 'r': case 'R': return RACK_JOB_READ;
+    case 'u': case 'U': return RACK_JOB_UNLOCK;
+    case 'v': case 'V': return RACK_JOB_CLONE;
+    case 'n': case 'N': return RACK_JOB_CYCLES;
+  }
+  return RACK_JOB_NONE;
+}
+
+// "013:ur" queues an unlock, then a read, on slots 0, 1 and 3; no slots
+// before the colon means all of them. Returns the jobs queued.
+static uint8_t job_parse(const char* line) {
+  const char* jobs = strchr(line, ':');
+  uint8_t slots = 0;
+  uint8_t n = 0;
+
+  if (!jobs) return 0;
+  for (const char* p = line; p < jobs; p++) {
+    if (*p >= '0' && *p < '0' + RACK_SLOTS) slots |= 1 << (*p - '0');
+  }
+  if (!slots) slots = RACK_ALL;
+
+  for (const char* p = jobs + 1; *p; p++) {
+    uint8_t job = job_letter(*p);
+    if (job == RACK_JOB_NONE) continue;
+    for (uint8_t s = 0; s < RACK_SLOTS; s++) {
+      if ((slots >> s) & 1) n += rackQueue(s, job);
+    }
+  }
+  return n;
+}
+
+void rackJobsMenu() {
+  char line[16];
+  uint8_t len = 0;
+  uint16_t queued = 0;
+
+  printSeparator();
+  Serial.println(F("     RACK JOBS"));
+  printSeparator();
+  Serial.println(F("Queue jobs as <slots>:<jobs>, e.g. 013:ur (no slots = all)"));
+  Serial.println(F("  r - read   u - unlock   v - clone saved MSG   n - cycles to 0"));
+  Serial.println(F("Empty line starts, 'c' cancels"));
+
+  for (;;) {
+    hal_idle();  // Returns at once if a key is waiting
+    if (!Serial.available()) continue;
+    char c = Serial.read();
+
+    if (c == 'c' || c == 'C') {
+      jobs_clear();
+      Serial.println(F("Cancelled"));
+      return;
+    }
+    if (c == '\r') continue;
+    if (c != '\n') {
+      if (len < sizeof(line) - 1) {
+        line[len++] = c;
+        Serial.print(c);
+      }
+      continue;
+    }
+    if (!len) break;
+
+    line[len] = '\0';
+    len = 0;
+    uint8_t n = job_parse(line);
+    queued += n;
+    Serial.print(F("  -> "));
+    Serial.print(n);
+    Serial.println(F(" queued"));
+  }
+
+  if (!queued) {
+    Serial.println(F("Nothing queued"));
+    return;
+  }
+  if (!rackJobsStart()) {
+    jobs_clear();
+    Serial.println(F("ERROR: Another operation is running"));
+  }
+}
+
+#endif
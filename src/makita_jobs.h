@@ -0,0 +1,42 @@
+/*
+ * Makita Battery Reader - Rack Job Scheduler
+ *
+ * Every rack slot has a short queue of jobs (read, unlock, clone, cycle
+ * reset). Each slot runs its queue as a task of its own, and one background
+ * task steps whichever slot is due. Most of a job is waiting - enable line
+ * low, chip waking up, EEPROM programming - so while one pack waits, the
+ * others use the bus. Bus transactions are short and run one slot at a time.
+ *
+ * Each finished job prints a CSV record with its wall time and the time its
+ * slot had the bus. When the queues are empty (or 'x'), a summary shows the
+ * jobs per hour and how much the jobs overlapped.
+ */
+
+#ifndef MAKITA_JOBS_H
+#define MAKITA_JOBS_H
+
+#include "config.h"
+
+#if RACK_SLOTS
+
+#define RACK_JOB_NONE   0
+#define RACK_JOB_READ   1  // ROM, MSG and cells
+#define RACK_JOB_UNLOCK 2  // Strategy ladder in learned order (makita_strategy)
+#define RACK_JOB_CLONE  3  // MSG saved with 's', error cleared
+#define RACK_JOB_CYCLES 4  // Cycle count back to 0
+
+#define RACK_QUEUE    4    // Jobs waiting per slot
+#define JOB_SETTLE_MS 700  // Power-on to the first transaction of a job
+#define JOB_RETRY_MS  100  // Between reads that failed
+
+bool rackQueue(uint8_t slot, uint8_t job);  // False if the queue is full
+bool rackJobsStart();
+void rackJobsStop();  // Jobs running are dropped, summary follows
+bool rackJobsActive();
+
+// Menu: queue lines like "013:ur", then start
+void rackJobsMenu();
+
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Makita Battery Reader - MSG Fields
+ *
+ * Named fields of the 32-byte MSG, read and written in place through a view
+ * over the buffer. A field is a constexpr descriptor (byte offset, nybble
+ * layout, mask). get()/set() take it by value and are always inlined, so the
+ * descriptors fold into the code instead of being kept in RAM.
+ *
+ *   MsgView v(msg);
+ *   v.set(MSG_ERROR, 0);
+ *   v.fixChecksums();
+ *
+ * ConstMsgView reads const buffers such as g_battery.msg.
+ */
+
+#ifndef MAKITA_MSG_H
+#define MAKITA_MSG_H
+
+#include "config.h"
+#include "makita_data.h"
+
+// Nybble layouts
+#define MSG_RAW     0  // Whole byte as stored
+#define MSG_LOW     1  // Low nybble
+#define MSG_HIGH    2  // High nybble
+#define MSG_SWAPPED 3  // Byte with its nybbles swapped
+#define MSG_SWAP16  4  // Two swapped bytes, high byte first
+
+struct MsgField {
+  uint8_t offset;
+  uint8_t layout;  // MSG_*
+  uint16_t mask;   // Value bits
+};
+
+// Nybble n lives in byte n / 2, low nybble first
+constexpr MsgField MSG_TYPE          = { 11, MSG_SWAPPED, 0xFF };    // Nybbles 22-23
+constexpr MsgField MSG_CAPACITY      = { 16, MSG_RAW, 0xFF };        // Capacity code, see get_capacity_mah()
+constexpr MsgField MSG_ERROR         = { 20, MSG_LOW, 0x0F };        // Nybble 40
+constexpr MsgField MSG_OVERDISCHARGE = { 24, MSG_SWAPPED, 0xFF };
+constexpr MsgField MSG_OVERLOAD      = { 25, MSG_SWAPPED, 0xFF };
+constexpr MsgField MSG_CYCLES        = { 26, MSG_SWAP16, 0x0FFF };   // Nybbles 52-55
+
+// Checksums (nybbles 41-43 and 62-63)
+constexpr MsgField MSG_CHK1 = { 20, MSG_HIGH, 0x0F };
+constexpr MsgField MSG_CHK2 = { 21, MSG_LOW, 0x0F };
+constexpr MsgField MSG_CHK3 = { 21, MSG_HIGH, 0x0F };
+constexpr MsgField MSG_CHK4 = { 31, MSG_LOW, 0x0F };
+constexpr MsgField MSG_CHK5 = { 31, MSG_HIGH, 0x0F };
+
+// Error codes
+#define MSG_ERR_OK         0x0
+#define MSG_ERR_OVERLOADED 0x1
+#define MSG_ERR_WARNING    0x5  // Charges anyway
+
+inline uint8_t swapNibbles(uint8_t b) {
+  return SWAP_NIBBLES(b);
+}
+
+template <typename B>
+class MsgViewT {
+  public:
+    explicit MsgViewT(B* msg) : p(msg) { }
+
+    B* data() const { return p; }
+
+    __attribute__((always_inline)) uint16_t get(MsgField f) const {
+      switch (f.layout) {
+        case MSG_LOW:     return p[f.offset] & 0x0F;
+        case MSG_HIGH:    return p[f.offset] >> 4;
+        case MSG_SWAPPED: return swapNibbles(p[f.offset]) & f.mask;
+        case MSG_SWAP16:  return ((swapNibbles(p[f.offset]) << 8) | swapNibbles(p[f.offset + 1])) & f.mask;
+        default:          return p[f.offset] & f.mask;
+      }
+    }
+
+    // Only compiles for a writable buffer; checksums are not touched
+    __attribute__((always_inline)) void set(MsgField f, uint16_t v) {
+      v &= f.mask;
+      switch (f.layout) {
+        case MSG_LOW:     p[f.offset] = (p[f.offset] & 0xF0) | v; break;
+        case MSG_HIGH:    p[f.offset] = (p[f.offset] & 0x0F) | (v << 4); break;
+        case MSG_SWAPPED: p[f.offset] = swapNibbles(v); break;
+        case MSG_SWAP16:
+          p[f.offset] = swapNibbles(v >> 8);
+          p[f.offset + 1] = swapNibbles(v & 0xFF);
+          break;
+        default:          p[f.offset] = v; break;
+      }
+    }
+
+    bool checksumsOk() const { return verifyMsgChecksums(p); }
+    void fixChecksums() { recalcMsgChecksums(p); }
+
+    // Error code that keeps the charger from charging
+    bool errorLocks() const {
+      uint8_t err = get(MSG_ERROR);
+      return err != MSG_ERR_OK && err != MSG_ERR_WARNING;
+    }
+
+  private:
+    B* p;
+};
+
+typedef MsgViewT<byte> MsgView;
+typedef MsgViewT<const byte> ConstMsgView;
+
+#endif
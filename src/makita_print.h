@@ -8,12 +8,15 @@
 #include "config.h"
 
 void printSeparator();
-void printHeader();
-void printModel();
-void printBatteryInfo();
-void printVoltages();
+void printFixed(int32_t value, uint8_t decimals);
 void printRawData();
 void printDiagnosis();
+void printReadStats();
+void printBusStatus(uint8_t status);  // BUS_* failure class
 void printMenu();
 
+// CSV records
+void printCell(uint32_t v);  // ',' then the value
+void printPackCells(const byte* rom, const byte* msg);  // rom,cycles,error,locked
+
 #endif
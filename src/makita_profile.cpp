@@ -0,0 +1,116 @@
+/*
+ * Makita Battery Reader - Pack Profile Cache
+ */
+
+#include <EEPROM.h>
+#include <stddef.h>
+#include "makita_profile.h"
+#include "makita_timing.h"
+
+// EEPROM layout: magic, slot of the last pack seen, then the slots
+#define PROFILE_EE_ADDR  0
+#define PROFILE_EE_MAGIC 0xA8
+#define PROFILE_SLOT_ADDR(i) (PROFILE_EE_ADDR + 2 + (i) * sizeof(PackProfile))
+
+static uint8_t profile_check(const PackProfile* p) {
+  const byte* b = (const byte*)p;
+  uint8_t sum = 0;
+  for (uint8_t i = 0; i < offsetof(PackProfile, check); i++) sum += b[i];
+  return ~sum;
+}
+
+static bool profile_valid(const PackProfile* p) {
+  return p->check == profile_check(p);
+}
+
+static bool profile_formatted() {
+  return EEPROM.read(PROFILE_EE_ADDR) == PROFILE_EE_MAGIC;
+}
+
+// Erased slots read as 0xFFFF
+static uint16_t slot_writes(const PackProfile* p) {
+  return p->writes == 0xFFFF ? 0 : p->writes;
+}
+
+static int8_t profile_find(const byte* rom, PackProfile* p) {
+  if (!profile_formatted()) return -1;
+
+  for (uint8_t i = 0; i < PROFILE_SLOTS; i++) {
+    EEPROM.get(PROFILE_SLOT_ADDR(i), *p);
+    if (profile_valid(p) && memcmp(p->rom, rom, 8) == 0) return i;
+  }
+  return -1;
+}
+
+// Free slots first, then the least written one
+static uint8_t profile_victim() {
+  PackProfile p;
+  uint8_t best = 0;
+  uint32_t best_score = 0xFFFFFFFF;
+
+  for (uint8_t i = 0; i < PROFILE_SLOTS; i++) {
+    EEPROM.get(PROFILE_SLOT_ADDR(i), p);
+    uint32_t score = slot_writes(&p) + (profile_valid(&p) ? 0x10000UL : 0);
+    if (score < best_score) {
+      best_score = score;
+      best = i;
+    }
+  }
+  return best;
+}
+
+// Written only when a different pack is connected
+static void profile_mark_last(uint8_t slot) {
+  EEPROM.update(PROFILE_EE_ADDR + 1, slot);
+}
+
+bool profile_load(const byte* rom, PackProfile* p) {
+  int8_t slot = profile_find(rom, p);
+  if (slot >= 0) {
+    profile_mark_last(slot);
+    return true;
+  }
+
+  memset(p, 0, sizeof(*p));
+  memcpy(p->rom, rom, 8);
+  p->chip = CHIP_UNKNOWN;
+  p->timing_pct = TIMING_DEFAULT;
+  return false;
+}
+
+void profile_save(PackProfile* p) {
+  PackProfile old;
+  int8_t slot;
+
+  // Blank or an older layout - break any slot that happens to check out
+  if (!profile_formatted()) {
+    for (uint8_t i = 0; i < PROFILE_SLOTS; i++) {
+      EEPROM.get(PROFILE_SLOT_ADDR(i), old);
+      if (profile_valid(&old)) EEPROM.update(PROFILE_SLOT_ADDR(i) + offsetof(PackProfile, check), ~old.check);
+    }
+    EEPROM.update(PROFILE_EE_ADDR, PROFILE_EE_MAGIC);
+  }
+
+  slot = profile_find(p->rom, &old);
+  if (slot >= 0) {
+    p->writes = old.writes;
+    p->check = profile_check(p);
+    if (memcmp(p, &old, sizeof(old)) == 0) return;
+  } else {
+    slot = profile_victim();
+    EEPROM.get(PROFILE_SLOT_ADDR(slot), old);
+    p->writes = slot_writes(&old);
+  }
+
+  p->writes++;
+  p->check = profile_check(p);
+  EEPROM.put(PROFILE_SLOT_ADDR(slot), *p);
+  profile_mark_last(slot);
+}
+
+bool profile_last(PackProfile* p) {
+  uint8_t slot = EEPROM.read(PROFILE_EE_ADDR + 1);
+  if (!profile_formatted() || slot >= PROFILE_SLOTS) return false;
+  EEPROM.get(PROFILE_SLOT_ADDR(slot), *p);
+  return profile_valid(p);
+}
@@ -0,0 +1,41 @@
+/*
+ * Makita Battery Reader - Pack Profile Cache
+ *
+ * What was learned about a pack - chip family, capabilities, calibrated
+ * timing and wake-up latency - is kept in the on-chip EEPROM, keyed by the
+ * ROM ID, so a pack seen before skips the probe when it is reconnected.
+ * Slots are only written when something changed. A new pack takes a free
+ * slot, or else the slot written the fewest times, which spreads the wear.
+ */
+
+#ifndef MAKITA_PROFILE_H
+#define MAKITA_PROFILE_H
+
+#include "config.h"
+
+#define PROFILE_SLOTS 16
+
+// 16 bytes, laid out without padding
+struct PackProfile {
+  byte rom[8];
+  uint16_t wake_ms;    // Power-on until the first answer, 0 = not measured
+  uint16_t writes;     // Times this slot has been written (any pack)
+  uint8_t chip;        // CHIP_*, CHIP_UNKNOWN = not probed
+  uint8_t caps;        // CHIP_CAP_*
+  uint8_t timing_pct;  // Calibrated recovery times, TIMING_DEFAULT if not calibrated
+  uint8_t check;       // ~(sum of the bytes above)
+};
+
+// First EEPROM byte after the profile area (magic, last slot, slots)
+#define PROFILE_EE_END (2 + PROFILE_SLOTS * sizeof(PackProfile))
+
+// Stored profile for this ROM; false and defaults if there is none
+bool profile_load(const byte* rom, PackProfile* p);
+
+// Store a profile (from profile_load); no EEPROM write if nothing changed
+void profile_save(PackProfile* p);
+
+// Profile of the pack seen last, e.g. to guess the next warm-up
+bool profile_last(PackProfile* p);
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * Makita Battery Reader - Battery Rack
+ */
+
+#include "makita_rack.h"
+
+#if RACK_SLOTS
+
+#include "makita_comm.h"
+#include "makita_data.h"
+#include "makita_msg.h"
+#include "makita_print.h"
+#include "makita_timing.h"
+
+#define RACK_ALL    ((uint8_t)((1 << RACK_SLOTS) - 1))
+#define RACK_STRIDE sizeof(RackSlot)
+#define RACK_GAP_US 310  // Reset to first byte, as for the single pack
+
+RackSlot g_rack[RACK_SLOTS];
+
+static uint32_t rack_ms;
+static uint16_t rack_resets;
+static uint8_t rack_powered = RACK_ALL;
+
+// ============== Bus ==============
+
+void rack_set_power(uint8_t slots, bool on) {
+  rack_powered = on ? rack_powered | slots : rack_powered & ~slots;
+  hal_rack_set_enable(rack_powered);
+}
+
+static bool rack_dead(const byte* p) {
+  for (uint8_t i = 0; i < BUS_PROBE_LEN; i++) {
+    if (p[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+static bool rack_zero(const byte* p, uint8_t len) {
+  for (uint8_t i = 0; i < len; i++) {
+    if (p[i]) return false;
+  }
+  return true;
+}
+
+// Slots whose strided response does not start with FF FF FF
+static uint8_t rack_answered(const byte* first, uint8_t slots) {
+  uint8_t r = 0;
+  for (uint8_t i = 0; i < RACK_SLOTS; i++, first += RACK_STRIDE) {
+    if (((slots >> i) & 1) && !rack_dead(first)) r |= 1 << i;
+  }
+  return r;
+}
+
+// Reset and initial byte; returns the slots that answered the reset
+static uint8_t rack_begin(uint8_t slots, uint8_t initial) {
+  slots = hal_rack_reset(slots);
+  if (slots) {
+    delayMicroseconds(RACK_GAP_US);
+    hal_rack_write_bytes(&initial, 1, slots, 0);
+  }
+  return slots;
+}
+
+// Bare ROM read; returns the slots that answered. The rest of the ROM is
+// only clocked if a probe came back.
+static uint8_t rack_poll_rom(uint8_t slots) {
+  slots = rack_begin(slots, 0x33);
+  if (!slots) return 0;
+
+  hal_rack_read_bytes(g_rack[0].rom, BUS_PROBE_LEN, slots, RACK_STRIDE);
+  slots = rack_answered(g_rack[0].rom, slots);
+  if (slots) hal_rack_read_bytes(g_rack[0].rom + BUS_PROBE_LEN, 8 - BUS_PROBE_LEN, slots, RACK_STRIDE);
+  return slots;
+}
+
+// Short temperature read - settles the chips and spends the 0xCC quirk
+static void rack_dummy_read(uint8_t slots) {
+  byte cmd[] = { 0xD7, 0x0E, 0x00, 0x02 };
+
+  slots = rack_begin(slots, 0xCC);
+  if (!slots) return;
+  hal_rack_write_bytes(cmd, 4, slots, 0);
+  hal_rack_read_bytes(g_rack[0].cells, 2, slots, RACK_STRIDE);
+}
+
+// Power cycle the slots and wait for them to answer, then settle them the
+// way warmup_battery() does an unknown pack
+static void rack_warmup(uint8_t slots) {
+  uint8_t up = 0;
+  uint32_t t0;
+
+  rack_set_power(slots, false);
+  delay(TRIGGER_POWER_OFF_MS);
+  rack_set_power(slots, true);
+  t0 = millis();
+
+  while ((up |= rack_poll_rom(slots & ~up)) != slots && millis() - t0 < WAKE_TIMEOUT_MS) {
+    delay(WAKE_POLL_MS);
+  }
+  uint32_t elapsed = millis() - t0;
+  if (elapsed < WAKE_SETTLE_MS) delay(WAKE_SETTLE_MS - elapsed);
+
+  for (uint8_t i = 0; i < 3; i++) {
+    hal_rack_reset(slots);
+    delay(100);
+    rack_dummy_read(slots);
+    delay(50);
+  }
+
+  hal_rack_reset(slots);
+  delay(100);
+}
+
+// ROM and MSG in one transaction; sets each slot's status, returns the
+// slots read
+static uint8_t rack_charger(uint8_t slots) {
+  byte cmd[] = { 0xF0, 0x00 };
+  uint8_t present = rack_begin(slots, 0x33);
+  uint8_t ok = 0;
+
+  if (present) {
+    hal_rack_read_bytes(g_rack[0].rom, 8, present, RACK_STRIDE);
+    hal_rack_write_bytes(cmd, 2, present, 0);
+    hal_rack_read_bytes(g_rack[0].msg, 32, present, RACK_STRIDE);
+  }
+
+  for (uint8_t i = 0; i < RACK_SLOTS; i++) {
+    RackSlot* s = &g_rack[i];
+
+    if (!((slots >> i) & 1)) continue;
+    if (!((present >> i) & 1)) {
+      s->status = BUS_NO_PRESENCE;
+    } else if (rack_dead(s->rom) || rack_dead(s->msg)) {
+      s->status = BUS_NO_ANSWER;
+    } else if (rack_zero(s->rom, 8)) {
+      s->status = BUS_GARBAGE;
+    } else {
+      s->status = BUS_OK;
+      ok |= 1 << i;
+    }
+  }
+  return ok;
+}
+
+// Cells from the data block - only standard chips answer it
+static void rack_cells(uint8_t slots) {
+  byte cmd[] = { 0xD7, 0x02, 0x00, 0x0A };
+
+  // The first 0xCC command after the charger read fails
+  rack_dummy_read(slots);
+
+  slots = rack_begin(slots, 0xCC);
+  if (!slots) return;
+  hal_rack_write_bytes(cmd, 4, slots, 0);
+  hal_rack_read_bytes(g_rack[0].cells, 10, slots, RACK_STRIDE);
+
+  for (uint8_t i = 0; i < RACK_SLOTS; i++) {
+    if ((slots >> i) & 1) g_rack[i].cells_ok = !(g_rack[i].cells[0] == 0xFF && g_rack[i].cells[1] == 0xFF);
+  }
+}
+
+uint8_t rack_read_slots(uint8_t slots) {
+  uint8_t ok = rack_charger(slots);
+  if (ok) rack_cells(ok);
+  return ok;
+}
+
+// Reset, initial byte and the ROM stage of a 0x33 command for one slot
+static uint8_t rack_slot_begin(uint8_t slot, uint8_t initial) {
+  byte rom[8];
+
+  if (!rack_begin(1 << slot, initial)) return BUS_NO_PRESENCE;
+  if (initial != 0x33) return BUS_OK;
+
+  hal_rack_read_bytes(rom, 8, 1 << slot, 0);
+  if (rack_dead(rom)) return BUS_NO_ANSWER;
+  return rack_zero(rom, 8) ? BUS_GARBAGE : BUS_OK;
+}
+
+uint8_t rack_slot_cmd(uint8_t slot, uint8_t initial, const byte* cmd, uint8_t cmd_len,
+                      byte* rsp, uint8_t rsp_len) {
+  uint8_t st = rack_slot_begin(slot, initial);
+  if (st != BUS_OK) return st;
+
+  hal_rack_write_bytes(cmd, cmd_len, 1 << slot, 0);
+  if (!rsp_len) return BUS_OK;
+  hal_rack_read_bytes(rsp, rsp_len, 1 << slot, 0);
+  return rsp_len >= BUS_PROBE_LEN && rack_dead(rsp) ? BUS_NO_ANSWER : BUS_OK;
+}
+
+uint8_t rack_slot_store(uint8_t slot, const byte* msg) {
+  static const byte cmd[] = { 0x0F, 0x00 };
+  uint8_t st = rack_slot_cmd(slot, 0x33, cmd, 2, NULL, 0);
+
+  if (st == BUS_OK) hal_rack_write_bytes(msg, 32, 1 << slot, 0);
+  return st;
+}
+
+uint8_t rackRead() {
+  uint8_t pending = RACK_ALL;
+  uint8_t ok = 0;
+  uint16_t resets = hal_reset_count;
+  uint32_t t0 = millis();
+
+  memset(g_rack, 0, sizeof(g_rack));
+  for (uint8_t i = 0; i < RACK_SLOTS; i++) g_rack[i].status = BUS_NO_PRESENCE;
+
+  // Rack packs are not calibrated - the shared slot timings go to default
+  timing_apply(TIMING_DEFAULT);
+
+  for (uint8_t pass = 0; pass < RACK_TRIES && pending; pass++) {
+    rack_warmup(pending);
+    ok |= rack_charger(pending);
+    pending &= ~ok;
+
+    // Silent through a whole warm-up - nothing in the slot
+    for (uint8_t i = 0; i < RACK_SLOTS; i++) {
+      if (g_rack[i].status == BUS_NO_PRESENCE) pending &= ~(1 << i);
+    }
+  }
+  if (ok) rack_cells(ok);
+
+  rack_ms = millis() - t0;
+  rack_resets = hal_reset_count - resets;
+  return ok;
+}
+
+// ============== Output ==============
+
+void printRack() {
+  uint8_t read = 0;
+
+  Serial.println(F("# slot,rom,cycles,error,locked,capacity_mAh,pack_mV,diff_mV"));
+  for (uint8_t i = 0; i < RACK_SLOTS; i++) {
+    const RackSlot* s = &g_rack[i];
+
+    if (s->status != BUS_OK) {
+      Serial.print(F("# "));
+      Serial.print(i);
+      Serial.print(F(": "));
+      printBusStatus(s->status);
+      continue;
+    }
+    read++;
+
+    ConstMsgView msg(s->msg);
+    Serial.print(i);
+    Serial.print(',');
+    printPackCells(s->rom, s->msg);
+    printCell(get_capacity_mah(msg.get(MSG_CAPACITY)));
+
+    // Cells into a data block for the shared decoder; no temperatures
+    Telemetry tm;
+    byte block[18];
+    memset(block, 0xFF, sizeof(block));
+    memcpy(block + 2, s->cells, 10);
+    if (s->cells_ok && decode_data_block(block, &tm)) {
+      printCell(tm.pack_mv);
+      printCell(tm.diff_mv);
+    } else {
+      Serial.print(F(",,"));
+    }
+    Serial.println();
+  }
+
+  Serial.print(F("# "));
+  Serial.print(read);
+  Serial.print(F(" of "));
+  Serial.print(RACK_SLOTS);
+  Serial.print(F(" slots in "));
+  Serial.print(rack_ms);
+  Serial.print(F(" ms, "));
+  Serial.print(rack_resets);
+  Serial.println(F(" bus resets"));
+}
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ * Makita Battery Reader - Battery Rack
+ *
+ * Up to RACK_SLOTS packs read side by side. Every transaction goes to all
+ * slots at once over the bit-parallel bus (hal_rack_*), so a full rack takes
+ * about the time of one pack. Slots that fail are power cycled through their
+ * own enable lines and retried on their own; empty slots are left out after
+ * the first warm-up. Results are kept per slot and printed as one CSV record
+ * per slot.
+ */
+
+#ifndef MAKITA_RACK_H
+#define MAKITA_RACK_H
+
+#include "config.h"
+
+#if RACK_SLOTS
+
+#define RACK_TRIES 3  // Passes over the slots still failing
+
+struct RackSlot {
+  byte rom[8];
+  byte msg[32];
+  byte cells[10];  // 0xD7 block bytes 2-11: five cells, mV, little endian
+  uint8_t status;  // BUS_* of the charger read
+  bool cells_ok;   // Standard chip - the data block answered
+};
+extern RackSlot g_rack[RACK_SLOTS];
+
+// Warm up and read every slot; returns the slots read (bit n = slot n)
+uint8_t rackRead();
+
+// Enable lines of these slots on or off, the others unchanged
+void rack_set_power(uint8_t slots, bool on);
+
+// ROM, MSG and cells of slots that are already awake; returns those read
+uint8_t rack_read_slots(uint8_t slots);
+
+// One transaction on one slot, no retries: reset, initial byte, the ROM for
+// 0x33, cmd, then rsp_len bytes into rsp. BUS_OK, BUS_NO_PRESENCE,
+// BUS_NO_ANSWER (ROM or response FF FF FF) or BUS_GARBAGE (zero ROM).
+uint8_t rack_slot_cmd(uint8_t slot, uint8_t initial, const byte* cmd, uint8_t cmd_len,
+                      byte* rsp, uint8_t rsp_len);
+
+// MSG into the scratchpad (test mode first, commit with 55 A5)
+uint8_t rack_slot_store(uint8_t slot, const byte* msg);
+
+// slot,rom,cycles,error,locked,capacity_mAh,pack_mV,diff_mV for the last read
+void printRack();
+
+#endif
+
+#endif
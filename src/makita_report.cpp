@@ -0,0 +1,550 @@
+/*
+ * Makita Battery Reader - Battery Report
+ */
+
+#include "makita_report.h"
+#include "makita_chip.h"
+#include "makita_data.h"
+#include "makita_msg.h"
+
+static uint8_t report_format = REPORT_TEXT;
+
+// ============== Line buffer ==============
+
+static char line[REPORT_LINE];
+static uint8_t line_len;
+
+static void put(char c) {
+  if (line_len == REPORT_LINE) {
+    Serial.write((const uint8_t*)line, line_len);
+    line_len = 0;
+  }
+  line[line_len++] = c;
+}
+
+static void putP(const char* s) {
+  char c;
+  while ((c = pgm_read_byte(s++))) put(c);
+}
+
+static void putS(const char* s) {
+  while (*s) put(*s++);
+}
+
+static void endLine() {
+  Serial.write((const uint8_t*)line, line_len);
+  Serial.println();
+  line_len = 0;
+}
+
+static void putU(uint32_t v) {
+  char digits[10];
+  uint8_t n = 0;
+  do {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  while (n) put(digits[--n]);
+}
+
+// value / 10^decimals, same format as printFixed()
+static void putFixed(int32_t value, uint8_t decimals) {
+  uint32_t div = 1;
+  for (uint8_t i = 0; i < decimals; i++) div *= 10;
+
+  if (value < 0) {
+    put('-');
+    value = -value;
+  }
+  putU((uint32_t)value / div);
+  if (!decimals) return;
+
+  uint32_t frac = (uint32_t)value % div;
+  put('.');
+  for (uint32_t d = div / 10; d > 1 && frac < d; d /= 10) put('0');
+  putU(frac);
+}
+
+static void putHex(byte b) {
+  static const char hex[] PROGMEM = "0123456789ABCDEF";
+  put(pgm_read_byte(&hex[b >> 4]));
+  put(pgm_read_byte(&hex[b & 0x0F]));
+}
+
+static void put2(uint8_t v) {
+  if (v < 10) put('0');
+  putU(v);
+}
+
+static void padTo(uint8_t col) {
+  while (line_len < col) put(' ');
+}
+
+// ============== Rows ==============
+
+// Row types
+#define ROW_HEAD  0  // Text: separator, centred label, separator
+#define ROW_BLANK 1  // Text: empty line
+#define ROW_TEXT  2  // Text: label only
+#define ROW_NUM   3  // Fixed point number
+#define ROW_HEX   4  // 0xNN
+#define ROW_BYTES 5  // Hex bytes, no spaces
+#define ROW_DATE  6  // D-MM-20YY from ROM bytes 2, 1, 0
+#define ROW_STR   7  // String
+#define ROW_CELLS 8  // ROW_NUM once per cell
+
+// Value sources
+#define SRC_NONE         0
+#define SRC_MODEL        1
+#define SRC_ROM          2
+#define SRC_MFG          3
+#define SRC_CYCLES       4
+#define SRC_ERROR        5
+#define SRC_STATUS       6
+#define SRC_CAPACITY     7
+#define SRC_TYPE         8
+#define SRC_OVERLOAD     9
+#define SRC_OVERDIS      10
+#define SRC_HEALTH       11
+#define SRC_SOC          12
+#define SRC_CHIP         13
+#define SRC_PACK         14
+#define SRC_DIFF         15
+#define SRC_T_CELL       16
+#define SRC_T_MOSFET     17
+#define SRC_T_NA         18
+#define SRC_CELL         19
+#define SRC_BALANCE      20
+#define SRC_READ_MS      21
+#define SRC_RESETS       22
+
+struct ReportRow {
+  uint8_t src;        // SRC_*
+  uint8_t type;       // ROW_*
+  uint8_t decimals;   // ROW_NUM / ROW_CELLS
+  uint8_t pad;        // Text: column the value starts at
+  const char* label;  // Text, NULL = machine formats only
+  const char* key;    // CSV / JSON, NULL = text only
+  const char* unit;   // Text, after the value
+};
+
+struct ReportValue {
+  int32_t num;
+  const char* str;    // ROW_STR
+  bool str_flash;     // str is in PROGMEM
+  const char* note;   // PROGMEM, text only, after the unit
+  const byte* bytes;  // ROW_BYTES / ROW_DATE
+  char buf[24];       // Storage for generated strings
+};
+
+#define S(name, text) static const char name[] PROGMEM = text
+
+S(T_INFO, "MAKITA BATTERY INFORMATION");
+S(T_VOLT, "VOLTAGE & TEMPERATURE");
+S(L_MODEL, "Model:");              S(K_MODEL, "model");
+S(L_ROM, "ROM ID:");               S(K_ROM, "rom");
+S(L_MFG, "Mfg Date:");             S(K_MFG, "mfg_date");
+S(L_CYCLES, "Charge Count:");      S(K_CYCLES, "cycles");
+S(L_ERROR, "Error Code:");         S(K_ERROR, "error");
+S(L_STATUS, "Status:");            S(K_STATUS, "status");
+S(L_CAPACITY, "Design Capacity:"); S(K_CAPACITY, "capacity_mah");
+S(L_TYPE, "Battery Type:");        S(K_TYPE, "type");
+S(L_OVERLOAD, "Overload:");        S(K_OVERLOAD, "overload_pct");
+S(L_OVERDIS, "Overdischarge:");    S(K_OVERDIS, "overdischarge_pct");
+S(L_HEALTH, "Health:");            S(K_HEALTH, "health_pct");
+S(L_SOC, "Charge (SOC):");         S(K_SOC, "soc_pct");
+S(K_CHIP, "chip");
+S(L_PACK, "Pack Voltage:");        S(K_PACK, "pack_v");
+S(L_DIFF, "Cell Difference:");     S(K_DIFF, "diff_v");
+S(L_TEMPS, "Temperature:");
+S(L_T_CELL, "  Cell:");            S(K_T_CELL, "t_cell_c");
+S(L_T_MOSFET, "  MOSFET:");        S(K_T_MOSFET, "t_mosfet_c");
+S(L_T_NA, "  Pack:");
+S(L_CELLS, "Individual Cell Voltages:");
+S(L_CELL, "  Cell ");              S(K_CELL, "cell_v");
+S(L_BALANCE, "Balance Status:");   S(K_BALANCE, "balance");
+S(K_READ_MS, "read_ms");
+S(K_RESETS, "bus_resets");
+
+S(U_NONE, "");
+S(U_PCT, "%");
+S(U_MAH, " mAh");
+S(U_V, " V");
+S(U_C, " C");
+
+#define COL 17  // Value column of the text report
+
+static const ReportRow info_rows[] PROGMEM = {
+  { SRC_NONE,     ROW_HEAD,  0, 0,   T_INFO,     NULL,       U_NONE },
+  { SRC_NONE,     ROW_BLANK, 0, 0,   NULL,       NULL,       U_NONE },
+  { SRC_MODEL,    ROW_STR,   0, COL, L_MODEL,    K_MODEL,    U_NONE },
+  { SRC_NONE,     ROW_BLANK, 0, 0,   NULL,       NULL,       U_NONE },
+  { SRC_ROM,      ROW_BYTES, 0, COL, L_ROM,      K_ROM,      U_NONE },
+  { SRC_MFG,      ROW_DATE,  0, COL, L_MFG,      K_MFG,      U_NONE },
+  { SRC_CYCLES,   ROW_NUM,   0, COL, L_CYCLES,   K_CYCLES,   U_NONE },
+  { SRC_ERROR,    ROW_HEX,   0, COL, L_ERROR,    K_ERROR,    U_NONE },
+  { SRC_STATUS,   ROW_STR,   0, COL, L_STATUS,   K_STATUS,   U_NONE },
+  { SRC_CAPACITY, ROW_NUM,   0, COL, L_CAPACITY, K_CAPACITY, U_MAH },
+  { SRC_TYPE,     ROW_NUM,   0, COL, L_TYPE,     K_TYPE,     U_NONE },
+  { SRC_OVERLOAD, ROW_NUM,   0, COL, L_OVERLOAD, K_OVERLOAD, U_PCT },
+  { SRC_OVERDIS,  ROW_NUM,   0, COL, L_OVERDIS,  K_OVERDIS,  U_PCT },
+  { SRC_HEALTH,   ROW_NUM,   0, COL, L_HEALTH,   K_HEALTH,   U_PCT },
+  { SRC_SOC,      ROW_NUM,   0, COL, L_SOC,      K_SOC,      U_PCT },
+  { SRC_CHIP,     ROW_STR,   0, 0,   NULL,       K_CHIP,     U_NONE },
+};
+
+static const ReportRow volt_rows[] PROGMEM = {
+  { SRC_NONE,     ROW_HEAD,  0, 0,   T_VOLT,     NULL,       U_NONE },
+  { SRC_PACK,     ROW_NUM,   2, COL, L_PACK,     K_PACK,     U_V },
+  { SRC_DIFF,     ROW_NUM,   3, COL, L_DIFF,     K_DIFF,     U_V },
+  { SRC_NONE,     ROW_BLANK, 0, 0,   NULL,       NULL,       U_NONE },
+  { SRC_NONE,     ROW_TEXT,  0, 0,   L_TEMPS,    NULL,       U_NONE },
+  { SRC_T_CELL,   ROW_NUM,   1, 11,  L_T_CELL,   K_T_CELL,   U_C },
+  { SRC_T_MOSFET, ROW_NUM,   1, 11,  L_T_MOSFET, K_T_MOSFET, U_C },
+  { SRC_T_NA,     ROW_STR,   0, 11,  L_T_NA,     NULL,       U_NONE },
+  { SRC_NONE,     ROW_BLANK, 0, 0,   NULL,       NULL,       U_NONE },
+  { SRC_NONE,     ROW_TEXT,  0, 0,   L_CELLS,    NULL,       U_NONE },
+  { SRC_CELL,     ROW_CELLS, 3, 16,  L_CELL,     K_CELL,     U_V },
+  { SRC_NONE,     ROW_BLANK, 0, 0,   NULL,       NULL,       U_NONE },
+  { SRC_BALANCE,  ROW_STR,   0, COL, L_BALANCE,  K_BALANCE,  U_NONE },
+  { SRC_READ_MS,  ROW_NUM,   0, 0,   NULL,       K_READ_MS,  U_NONE },
+  { SRC_RESETS,   ROW_NUM,   0, 0,   NULL,       K_RESETS,   U_NONE },
+};
+
+#define ROW_COUNT(rows) (sizeof(rows) / sizeof(rows[0]))
+
+// ============== Values ==============
+
+S(V_LOCKED, "LOCKED");       S(V_OK, "OK");
+S(V_OVERLOADED, "Overloaded"); S(V_WARNING, "Warning");     S(V_ERROR, "ERROR");
+S(V_BMS, "(BMS)");           S(V_EST, "(est)");
+S(V_STD, "STD");             S(V_F0513, "F0513");         S(V_BL36, "BL36");
+S(V_NA, "N/A");              S(V_UNKNOWN, "Unknown/Not detected");
+S(V_GOOD, "GOOD");           S(V_FAIR, "FAIR");           S(V_POOR, "POOR");
+S(N_GOOD, "(< 20mV)");       S(N_OK, "(< 50mV)");         S(N_FAIR, "(< 150mV)");
+S(N_POOR, "(> 150mV) - Balancing needed!");
+
+static int16_t clampPercent(int16_t p) {
+  return p < 0 ? 0 : (p > 100 ? 100 : p);
+}
+
+static void flashStr(ReportValue* v, const char* s) {
+  v->str = s;
+  v->str_flash = true;
+}
+
+// Overload, overdischarge and health: BMS values where the chip has them,
+// otherwise estimated from the MSG (p = 5x - 160, p = -5x + 160, cycles / 896)
+static int16_t msgPercent(uint8_t src) {
+  ConstMsgView msg(g_battery.msg);
+
+  if (chip_has_health()) {
+    if (src == SRC_OVERLOAD) return overload();
+    if (src == SRC_OVERDIS) return overdischarge();
+    return health();
+  }
+  if (src == SRC_OVERLOAD) return clampPercent(5 * msg.get(MSG_OVERLOAD) - 160);
+  if (src == SRC_OVERDIS) return clampPercent(-5 * msg.get(MSG_OVERDISCHARGE) + 160);
+  return clampPercent(100 - (int16_t)((uint32_t)msg.get(MSG_CYCLES) * 100 / 896));
+}
+
+// Fill v for source src (idx = cell); false if the battery has no such value
+static bool getValue(uint8_t src, uint8_t idx, ReportValue* v) {
+  ConstMsgView msg(g_battery.msg);
+  const Telemetry* tm = &g_battery.tm;
+  bool cells = tm->cell_count > 0;
+
+  memset(v, 0, sizeof(*v));
+  if (src != SRC_MODEL && !g_battery.valid) return false;
+
+  switch (src) {
+    case SRC_MODEL:
+      if (chip_model(v->buf)) {
+        v->str = v->buf;
+      } else if (g_battery.valid) {
+        int cap = get_capacity_for_model(msg.get(MSG_CAPACITY));
+        if (msg.get(MSG_TYPE) == 14) sprintf(v->buf, "BL3626");
+        else if (msg.get(MSG_OVERLOAD) < 0xC) sprintf(v->buf, "BL14%02d", cap);
+        else sprintf(v->buf, "BL18%02d", cap);
+        v->str = v->buf;
+      } else {
+        flashStr(v, V_UNKNOWN);
+      }
+      return true;
+
+    case SRC_ROM:
+      v->bytes = g_battery.rom;
+      v->num = 8;
+      return true;
+
+    case SRC_MFG:
+      v->bytes = g_battery.rom;
+      return true;
+
+    case SRC_CYCLES:
+      v->num = msg.get(MSG_CYCLES);
+      return true;
+
+    case SRC_ERROR:
+      v->num = msg.get(MSG_ERROR);
+      v->note = v->num == MSG_ERR_OK ? V_OK :
+                v->num == MSG_ERR_OVERLOADED ? V_OVERLOADED :
+                v->num == MSG_ERR_WARNING ? V_WARNING : V_ERROR;
+      return true;
+
+    case SRC_STATUS:
+      // Error code AND checksums decide (required for charger!)
+      flashStr(v, msg.errorLocks() || !msg.checksumsOk() ? V_LOCKED : V_OK);
+      return true;
+
+    case SRC_CAPACITY:
+      v->num = get_capacity_mah(msg.get(MSG_CAPACITY));
+      return true;
+
+    case SRC_TYPE:
+      v->num = msg.get(MSG_TYPE);
+      return true;
+
+    case SRC_OVERLOAD:
+    case SRC_OVERDIS:
+      v->num = msgPercent(src);
+      return true;
+
+    case SRC_HEALTH:
+      v->num = msgPercent(src);
+      v->note = chip_has_health() ? V_BMS : V_EST;
+      return true;
+
+    case SRC_SOC: {
+      if (!cells) return false;
+      uint16_t min_mv = tm->cell_mv[0];
+      for (uint8_t i = 1; i < tm->cell_count; i++) {
+        if (tm->cell_mv[i] < min_mv) min_mv = tm->cell_mv[i];
+      }
+      v->num = voltage_to_soc(min_mv);
+      return true;
+    }
+
+    case SRC_CHIP:
+      if (g_battery.chip == CHIP_UNKNOWN) return false;
+      flashStr(v, g_battery.chip == CHIP_BL36 ? V_BL36 : g_battery.chip == CHIP_F0513 ? V_F0513 : V_STD);
+      return true;
+
+    case SRC_PACK:
+      v->num = (tm->pack_mv + 5) / 10;
+      return cells;
+
+    case SRC_DIFF:
+      v->num = tm->diff_mv;
+      return cells;
+
+    case SRC_T_CELL:
+      v->num = tm->t_cell;
+      return cells && g_battery.chip != CHIP_BL36 && tm->t_cell != TEMP_NONE;
+
+    case SRC_T_MOSFET:
+      v->num = tm->t_mosfet;
+      return cells && g_battery.chip != CHIP_BL36 && tm->t_mosfet != TEMP_NONE && tm->t_mosfet > 0;
+
+    case SRC_T_NA:
+      flashStr(v, V_NA);
+      return g_battery.chip == CHIP_BL36;
+
+    case SRC_CELL:
+      v->num = tm->cell_mv[idx];
+      return cells;
+
+    case SRC_BALANCE:
+      if (!cells) return false;
+      if (tm->diff_mv < 20) { flashStr(v, V_GOOD); v->note = N_GOOD; }
+      else if (tm->diff_mv < 50) { flashStr(v, V_OK); v->note = N_OK; }
+      else if (tm->diff_mv < 150) { flashStr(v, V_FAIR); v->note = N_FAIR; }
+      else { flashStr(v, V_POOR); v->note = N_POOR; }
+      return true;
+
+    case SRC_READ_MS:
+      v->num = g_battery.read_ms;
+      return true;
+
+    case SRC_RESETS:
+      v->num = g_battery.bus_resets;
+      return true;
+  }
+  return false;
+}
+
+// ============== Rendering ==============
+
+static void putValue(const ReportRow* r, const ReportValue* v) {
+  switch (r->type) {
+    case ROW_NUM:
+    case ROW_CELLS:
+      putFixed(v->num, r->decimals);
+      break;
+    case ROW_HEX:
+      if (report_format == REPORT_TEXT) {
+        putP(PSTR("0x"));
+        putHex(v->num);
+      } else {
+        putU(v->num);
+      }
+      break;
+    case ROW_BYTES:
+      for (uint8_t i = 0; i < v->num; i++) putHex(v->bytes[i]);
+      break;
+    case ROW_DATE:
+      putU(v->bytes[2]);
+      put('-');
+      put2(v->bytes[1]);
+      putP(PSTR("-20"));
+      put2(v->bytes[0]);
+      break;
+    case ROW_STR:
+      if (v->str_flash) putP(v->str);
+      else putS(v->str);
+      break;
+  }
+}
+
+static bool quoted(uint8_t type) {
+  return type == ROW_STR || type == ROW_BYTES || type == ROW_DATE;
+}
+
+static void renderText(const ReportRow* rows, uint8_t count) {
+  ReportValue v;
+  ReportRow r;
+
+  for (uint8_t i = 0; i < count; i++) {
+    memcpy_P(&r, &rows[i], sizeof(r));
+
+    if (r.type == ROW_HEAD) {
+      putP(PSTR("========================================"));
+      endLine();
+      padTo((40 - strlen_P(r.label)) / 2);
+      putP(r.label);
+      endLine();
+      putP(PSTR("========================================"));
+      endLine();
+      continue;
+    }
+    if (r.type == ROW_BLANK || r.type == ROW_TEXT) {
+      if (r.label) putP(r.label);
+      endLine();
+      continue;
+    }
+    if (!r.label) continue;
+
+    uint8_t n = (r.type == ROW_CELLS) ? g_battery.tm.cell_count : 1;
+    for (uint8_t idx = 0; idx < n; idx++) {
+      if (!getValue(r.src, idx, &v)) break;
+      putP(r.label);
+      if (r.type == ROW_CELLS) {
+        putU(idx + 1);
+        put(':');
+      }
+      padTo(r.pad);
+      putValue(&r, &v);
+      putP(r.unit);
+      if (v.note) {
+        put(' ');
+        putP(v.note);
+      }
+      endLine();
+    }
+  }
+}
+
+// CSV: keys (header) or values; JSON: "key":value pairs. Missing values
+// stay empty in CSV and are null in JSON.
+static void renderMachine(const ReportRow* rows, uint8_t count, bool header, bool* first) {
+  ReportValue v;
+  ReportRow r;
+  bool json = (report_format == REPORT_JSON);
+
+  for (uint8_t i = 0; i < count; i++) {
+    memcpy_P(&r, &rows[i], sizeof(r));
+    if (!r.key) continue;
+
+    if (!*first) put(',');
+    *first = false;
+
+    if (json) {
+      put('"');
+      putP(r.key);
+      putP(PSTR("\":"));
+    }
+
+    if (r.type == ROW_CELLS) {
+      uint8_t n = g_battery.tm.cell_count;
+      if (json) put('[');
+      for (uint8_t idx = 0; idx < n; idx++) {
+        if (idx) put(',');
+        if (header) {
+          putP(r.key);
+          putU(idx + 1);
+        } else if (getValue(r.src, idx, &v)) {
+          putValue(&r, &v);
+        }
+      }
+      if (json) put(']');
+      continue;
+    }
+
+    if (header) {
+      putP(r.key);
+    } else if (!getValue(r.src, 0, &v)) {
+      if (json) putP(PSTR("null"));
+    } else {
+      if (json && quoted(r.type)) put('"');
+      putValue(&r, &v);
+      if (json && quoted(r.type)) put('"');
+    }
+  }
+}
+
+// ============== Public ==============
+
+void reportSetFormat(uint8_t format) {
+  report_format = format;
+}
+
+uint8_t reportFormat() {
+  return report_format;
+}
+
+void reportNextFormat() {
+  report_format = (report_format + 1) % 3;
+  Serial.print(F("\nReport format: "));
+  Serial.println(report_format == REPORT_JSON ? F("JSON") : report_format == REPORT_CSV ? F("CSV") : F("text"));
+}
+
+void printReport() {
+  bool first;
+
+  if (report_format == REPORT_TEXT) {
+    endLine();
+    renderText(info_rows, ROW_COUNT(info_rows));
+    endLine();
+    if (g_battery.valid && g_battery.tm.cell_count > 0) {
+      renderText(volt_rows, ROW_COUNT(volt_rows));
+    } else {
+      putP(PSTR("ERROR: Cannot read voltage data"));
+      endLine();
+    }
+    return;
+  }
+
+  if (report_format == REPORT_CSV) {
+    first = true;
+    renderMachine(info_rows, ROW_COUNT(info_rows), true, &first);
+    renderMachine(volt_rows, ROW_COUNT(volt_rows), true, &first);
+    endLine();
+  }
+
+  first = true;
+  if (report_format == REPORT_JSON) put('{');
+  renderMachine(info_rows, ROW_COUNT(info_rows), false, &first);
+  renderMachine(volt_rows, ROW_COUNT(volt_rows), false, &first);
+  if (report_format == REPORT_JSON) put('}');
+  endLine();
+}
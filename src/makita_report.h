@@ -0,0 +1,29 @@
+/*
+ * Makita Battery Reader - Battery Report
+ *
+ * The battery report (model, MSG fields, voltages and temperatures) is a
+ * PROGMEM table of rows: label, machine key, unit and a value source. One
+ * renderer walks the table and formats into a line buffer that is written
+ * to the port a whole line at a time. The same rows render as the text
+ * report, as one CSV header + value line, or as one JSON object.
+ */
+
+#ifndef MAKITA_REPORT_H
+#define MAKITA_REPORT_H
+
+#include "config.h"
+
+#define REPORT_TEXT 0
+#define REPORT_CSV  1
+#define REPORT_JSON 2
+
+#define REPORT_LINE 64  // Line buffer; longer lines go out in pieces
+
+void reportSetFormat(uint8_t format);
+uint8_t reportFormat();
+void reportNextFormat();  // Menu: text -> CSV -> JSON -> text
+
+// g_battery in the current format (text: both report sections)
+void printReport();
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Makita Battery Reader - Bus Statistics
+ */
+
+#include "makita_stats.h"
+#include "makita_comm.h"
+#include "makita_commands.h"
+#include "makita_host.h"
+#include "makita_print.h"
+
+BusStats g_stats;
+
+static LatencyHist hist[STATS_HIST_SLOTS];
+static bool hist_ready = false;
+
+// HAL counters at the last reset
+static uint16_t base_resets;
+static uint32_t base_tx, base_rx;
+
+static uint8_t bucket_of(uint32_t us) {
+  uint8_t b = 0;
+  us >>= STATS_BUCKET_SHIFT;
+  while (us && b < STATS_BUCKETS - 1) {
+    us >>= 1;
+    b++;
+  }
+  return b;
+}
+
+static void hist_init() {
+  memset(hist, 0, sizeof(hist));
+  for (uint8_t i = 0; i < STATS_HIST_SLOTS; i++) hist[i].id = 0xFF;
+  hist_ready = true;
+}
+
+static LatencyHist* hist_for(uint8_t id) {
+  if (!hist_ready) hist_init();
+
+  for (uint8_t i = 0; i < STATS_HIST_SLOTS; i++) {
+    if (hist[i].id == id) return &hist[i];
+    if (hist[i].id == 0xFF) {
+      hist[i].id = id;
+      return &hist[i];
+    }
+  }
+  return NULL;
+}
+
+void stats_command(uint8_t id, uint8_t attempts, uint8_t status, uint32_t us) {
+  LatencyHist* h = hist_for(id);
+
+  g_stats.commands++;
+  if (attempts > 1) g_stats.retries += attempts - 1;
+  if (status == BUS_TIMEOUT) g_stats.timeouts++;
+  if (!h) return;
+  h->retries += attempts - 1;
+  h->count[bucket_of(us)]++;
+}
+
+void stats_reset() {
+  memset(&g_stats, 0, sizeof(g_stats));
+  hist_init();
+
+  base_resets = hal_reset_count;
+  base_tx = hal_tx_bytes;
+  base_rx = hal_rx_bytes;
+}
+
+// ============== Output ==============
+
+static void printCounter(const __FlashStringHelper* label, uint32_t value) {
+  Serial.print(label);
+  Serial.println(value);
+}
+
+// Right-aligned in five characters
+static void printColumn(uint16_t n) {
+  if (n < 10000) Serial.print(' ');
+  if (n < 1000) Serial.print(' ');
+  if (n < 100) Serial.print(' ');
+  if (n < 10) Serial.print(' ');
+  Serial.print(n);
+}
+
+void printStats() {
+  if (!hist_ready) hist_init();
+
+  printSeparator();
+  Serial.println(F("  BUS STATISTICS"));
+  printSeparator();
+  printCounter(F("Resets:           "), (uint16_t)(hal_reset_count - base_resets));
+  printCounter(F("Presence fails:   "), g_stats.presence_fail);
+  printCounter(F("No answer (FF):   "), g_stats.no_answer);
+  printCounter(F("Garbled ROM:      "), g_stats.garbage);
+  printCounter(F("Power cycles:     "), g_stats.power_cycles);
+  printCounter(F("Commands:         "), g_stats.commands);
+  printCounter(F("Retries:          "), g_stats.retries);
+  printCounter(F("Budget timeouts:  "), g_stats.timeouts);
+  printCounter(F("Bytes written:    "), hal_tx_bytes - base_tx);
+  printCounter(F("Bytes read:       "), hal_rx_bytes - base_rx);
+
+  Serial.println(F("\nLatency ms:      retry   <2   <4   <8  <16  <32  <64 <128 >=128"));
+  for (uint8_t i = 0; i < STATS_HIST_SLOTS && hist[i].id != 0xFF; i++) {
+    byte key[CMD_KEY_LEN];
+    uint8_t len = cmd_key(hist[i].id, key);
+
+    // Whole opcode - commands differ only in the length byte too
+    Serial.print(F("  "));
+    printHex(key[0]);
+    Serial.print(':');
+    for (uint8_t k = 1; k < CMD_KEY_LEN; k++) {
+      if (k > len) Serial.print(F("  "));
+      else printHex(key[k]);
+      Serial.print(' ');
+    }
+    printColumn(hist[i].retries);
+    for (uint8_t b = 0; b < STATS_BUCKETS; b++) printColumn(hist[i].count[b]);
+    Serial.println();
+  }
+}
+
+// resets u16 | presence_fail .. timeouts (u16 each) | tx u32 | rx u32 | n |
+// n x (initial, op[4] zero padded, retries u16, count[8] u16)
+void stats_send(byte cmd) {
+  uint8_t n = 0;
+  uint16_t resets;
+  uint32_t tx, rx;
+
+  if (!hist_ready) hist_init();
+  while (n < STATS_HIST_SLOTS && hist[n].id != 0xFF) n++;
+
+  resets = hal_reset_count - base_resets;
+  tx = hal_tx_bytes - base_tx;
+  rx = hal_rx_bytes - base_rx;
+
+  hostBegin(cmd, HOST_OK, 2 + sizeof(g_stats) + 8 + 1 + n * (CMD_KEY_LEN + 2 + 2 * STATS_BUCKETS));
+  hostWrite((const byte*)&resets, 2);
+  hostWrite((const byte*)&g_stats, sizeof(g_stats));
+  hostWrite((const byte*)&tx, 4);
+  hostWrite((const byte*)&rx, 4);
+  hostWrite(&n, 1);
+  for (uint8_t i = 0; i < n; i++) {
+    byte key[CMD_KEY_LEN];
+    cmd_key(hist[i].id, key);
+    hostWrite(key, CMD_KEY_LEN);
+    hostWrite((const byte*)&hist[i].retries, 2);
+    hostWrite((const byte*)hist[i].count, 2 * STATS_BUCKETS);
+  }
+  hostEnd();
+}
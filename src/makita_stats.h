@@ -0,0 +1,46 @@
+/*
+ * Makita Battery Reader - Bus Statistics
+ *
+ * Counters of everything the bus did since boot or the last reset, and a
+ * latency histogram and retry count for each table command (micros() around
+ * the whole command, retries included). Histogram buckets are powers of two:
+ * bucket b counts commands that took 2^(b+10) to 2^(b+11) us, with the
+ * first and last buckets open-ended (< 2 ms, >= 128 ms).
+ */
+
+#ifndef MAKITA_STATS_H
+#define MAKITA_STATS_H
+
+#include "config.h"
+
+#define STATS_BUCKETS      8
+#define STATS_BUCKET_SHIFT 11  // Upper bound of bucket 0 is 2^11 us
+#define STATS_HIST_SLOTS   8   // Commands with a histogram; later ones only count
+
+struct BusStats {
+  uint16_t presence_fail;  // Attempts without a presence pulse
+  uint16_t no_answer;      // Attempts answered with 0xFF
+  uint16_t garbage;        // Attempts with a garbled ROM stage
+  uint16_t power_cycles;   // Enable line switched off
+  uint16_t commands;       // Table commands run
+  uint16_t retries;        // Attempts beyond the first
+  uint16_t timeouts;       // Commands stopped by their time budget
+};
+extern BusStats g_stats;
+
+struct LatencyHist {
+  uint8_t id;        // CMD_*, 0xFF = free
+  uint16_t retries;  // Attempts beyond the first
+  uint16_t count[STATS_BUCKETS];
+};
+
+// Record one table command (from cmd_exec / cmd_once)
+void stats_command(uint8_t id, uint8_t attempts, uint8_t status, uint32_t us);
+
+void stats_reset();
+void printStats();
+
+// Host dump: counters, then the histograms in use
+void stats_send(byte cmd);
+
+#endif
@@ -0,0 +1,224 @@
+/*
+ * Makita Battery Reader - Unlock Strategies
+ */
+
+#include <EEPROM.h>
+#include <stddef.h>
+#include "makita_strategy.h"
+#include "makita_comm.h"
+#include "makita_print.h"
+#include "makita_profile.h"
+
+// ============== Table ==============
+
+static const char S_RESET[] PROGMEM = "Standard reset";
+static const char S_WRITE[] PROGMEM = "EEPROM checksum fix";
+static const char S_CYCLE[] PROGMEM = "Extended power cycling";
+
+static const UnlockStep unlock_steps[] PROGMEM = {
+  // Standard reset: short power cycle, 5 test mode / reset pairs
+  { STEP_POWER,  1, TRIGGER_POWER_OFF_MS, TRIGGER_POWER_MS - TRIGGER_POWER_OFF_MS },
+  { STEP_RESETS, 5, 200, 0 },
+  // EEPROM checksum fix: write, then a long power cycle to commit
+  { STEP_WRITE,  1, 0, 0 },
+  { STEP_POWER,  1, 2000, 1000 },
+  // Extended power cycling: long power cycle, 10 slower pairs
+  { STEP_POWER,  1, 2000, 1000 },
+  { STEP_RESETS, 10, 100, 100 },
+};
+
+static const UnlockStrategy unlock_strategies[UNLOCK_STRATEGIES] PROGMEM = {
+  { S_RESET, 0, 2, 5 },
+  { S_WRITE, 2, 2, 3 },
+  { S_CYCLE, 4, 2, 3 },
+};
+
+void strategy_get(uint8_t idx, UnlockStrategy* s) {
+  memcpy_P(s, &unlock_strategies[idx], sizeof(*s));
+}
+
+void strategy_step(uint8_t idx, UnlockStep* st) {
+  memcpy_P(st, &unlock_steps[idx], sizeof(*st));
+}
+
+bool strategy_writes(const UnlockStrategy* s) {
+  UnlockStep st;
+  for (uint8_t i = 0; i < s->steps; i++) {
+    strategy_step(s->first + i, &st);
+    if (st.op == STEP_WRITE) return true;
+  }
+  return false;
+}
+
+// ============== Statistics ==============
+
+// EEPROM layout after the pack profiles: magic, then the records
+#define STATS_EE_ADDR  PROFILE_EE_END
+#define STATS_EE_MAGIC 0x5B
+#define STATS_SLOTS    8
+#define STATS_SLOT_ADDR(i) (STATS_EE_ADDR + 1 + (i) * sizeof(UnlockRecord))
+
+#define MEAN_WEIGHT 8  // Mean over about the last 8 successes
+
+struct StrategyStat {
+  uint8_t runs;
+  uint8_t wins;
+  uint16_t mean_ds;  // Mean time to success, 0.1 s
+};
+
+// 16 bytes, laid out without padding
+struct UnlockRecord {
+  uint8_t chip;      // CHIP_*
+  uint8_t error;     // MSG error code, UNLOCK_ERR_UNKNOWN
+  StrategyStat s[UNLOCK_STRATEGIES];
+  uint8_t uses;      // Strategy runs with this key, saturating
+  uint8_t check;     // ~(sum of the bytes above)
+};
+
+static uint8_t record_check(const UnlockRecord* r) {
+  const byte* b = (const byte*)r;
+  uint8_t sum = 0;
+  for (uint8_t i = 0; i < offsetof(UnlockRecord, check); i++) sum += b[i];
+  return ~sum;
+}
+
+static bool record_valid(const UnlockRecord* r) {
+  return EEPROM.read(STATS_EE_ADDR) == STATS_EE_MAGIC && r->check == record_check(r);
+}
+
+static int8_t record_find(uint8_t chip, uint8_t error, UnlockRecord* r) {
+  for (uint8_t i = 0; i < STATS_SLOTS; i++) {
+    EEPROM.get(STATS_SLOT_ADDR(i), *r);
+    if (record_valid(r) && r->chip == chip && r->error == error) return i;
+  }
+  return -1;
+}
+
+// Free slots first, then the least used key
+static uint8_t record_victim() {
+  UnlockRecord r;
+  uint8_t best = 0;
+  uint16_t best_score = 0xFFFF;
+
+  for (uint8_t i = 0; i < STATS_SLOTS; i++) {
+    EEPROM.get(STATS_SLOT_ADDR(i), r);
+    uint16_t score = record_valid(&r) ? 0x100 + r.uses : 0;
+    if (score < best_score) {
+      best_score = score;
+      best = i;
+    }
+  }
+  return best;
+}
+
+void strategy_order(uint8_t chip, uint8_t error, uint8_t* order) {
+  UnlockRecord r;
+  uint32_t score[UNLOCK_STRATEGIES];
+
+  if (record_find(chip, error, &r) < 0) memset(&r, 0, sizeof(r));
+
+  // Ties keep table order - the ladder is the default
+  for (uint8_t i = 0; i < UNLOCK_STRATEGIES; i++) {
+    const StrategyStat* s = &r.s[i];
+    score[i] = s->wins ? s->mean_ds : (s->runs ? 0x20000UL : 0x10000UL);
+    order[i] = i;
+  }
+  for (uint8_t i = 1; i < UNLOCK_STRATEGIES; i++) {
+    for (uint8_t j = i; j > 0 && score[order[j]] < score[order[j - 1]]; j--) {
+      uint8_t tmp = order[j];
+      order[j] = order[j - 1];
+      order[j - 1] = tmp;
+    }
+  }
+}
+
+void strategy_record(uint8_t chip, uint8_t error, uint8_t idx, bool won, uint32_t ms) {
+  UnlockRecord r;
+  int8_t slot = record_find(chip, error, &r);
+
+  // Blank or older contents - break any slot that happens to check out
+  if (EEPROM.read(STATS_EE_ADDR) != STATS_EE_MAGIC) {
+    UnlockRecord old;
+    for (uint8_t i = 0; i < STATS_SLOTS; i++) {
+      EEPROM.get(STATS_SLOT_ADDR(i), old);
+      if (old.check == record_check(&old)) EEPROM.update(STATS_SLOT_ADDR(i) + offsetof(UnlockRecord, check), ~old.check);
+    }
+    EEPROM.update(STATS_EE_ADDR, STATS_EE_MAGIC);
+  }
+  if (slot < 0) {
+    slot = record_victim();
+    memset(&r, 0, sizeof(r));
+    r.chip = chip;
+    r.error = error;
+  }
+
+  StrategyStat* s = &r.s[idx];
+
+  // Halve old history instead of overflowing
+  if (s->runs == 0xFF) {
+    s->runs /= 2;
+    s->wins /= 2;
+  }
+  s->runs++;
+  if (won) {
+    uint16_t ds = ms / 100 > 0xFFFF ? 0xFFFF : ms / 100;
+    uint8_t n = s->wins < MEAN_WEIGHT ? s->wins + 1 : MEAN_WEIGHT;
+    s->mean_ds = s->wins ? s->mean_ds + ((int32_t)ds - s->mean_ds) / n : ds;
+    s->wins++;
+  }
+  if (r.uses < 0xFF) r.uses++;
+
+  r.check = record_check(&r);
+  EEPROM.put(STATS_SLOT_ADDR(slot), r);
+}
+
+// ============== Output ==============
+
+static void printChipName(uint8_t chip) {
+  switch (chip) {
+    case CHIP_STD:   Serial.print(F("STD  ")); break;
+    case CHIP_F0513: Serial.print(F("F0513")); break;
+    case CHIP_BL36:  Serial.print(F("BL36 ")); break;
+    case UNLOCK_CHIP_RACK: Serial.print(F("rack ")); break;
+    default:         Serial.print(F("?    ")); break;
+  }
+}
+
+void printStrategyStats() {
+  UnlockRecord r;
+  UnlockStrategy st;
+  bool any = false;
+
+  printSeparator();
+  Serial.println(F("     UNLOCK STRATEGY STATISTICS"));
+  printSeparator();
+
+  for (uint8_t i = 0; i < STATS_SLOTS; i++) {
+    EEPROM.get(STATS_SLOT_ADDR(i), r);
+    if (!record_valid(&r)) continue;
+    any = true;
+
+    Serial.print(F("Chip "));
+    printChipName(r.chip);
+    Serial.print(F(" error "));
+    if (r.error == UNLOCK_ERR_UNKNOWN) Serial.println('?');
+    else Serial.println(r.error, HEX);
+
+    for (uint8_t k = 0; k < UNLOCK_STRATEGIES; k++) {
+      strategy_get(k, &st);
+      Serial.print(F("  "));
+      Serial.print(reinterpret_cast<const __FlashStringHelper*>(st.name));
+      Serial.print(F(": "));
+      Serial.print(r.s[k].wins);
+      Serial.print('/');
+      Serial.print(r.s[k].runs);
+      if (r.s[k].wins) {
+        Serial.print(F(", mean "));
+        printFixed(r.s[k].mean_ds, 1);
+        Serial.print(F(" s"));
+      }
+      Serial.println();
+    }
+  }
+  if (!any) Serial.println(F("No unlock runs recorded yet"));
+}
@@ -0,0 +1,53 @@
+/*
+ * Makita Battery Reader - Unlock Strategies
+ *
+ * The unlock ladder as data. A strategy is a short list of steps, repeated
+ * a few times with a lock check after every repetition. How each strategy
+ * did is kept in the on-chip EEPROM (after the pack profiles) per chip
+ * family and error code, and the next unlock with the same key tries the
+ * strategy with the shortest mean time to success first.
+ */
+
+#ifndef MAKITA_STRATEGY_H
+#define MAKITA_STRATEGY_H
+
+#include "config.h"
+
+// Step operations
+#define STEP_POWER  0  // Enable pin off for a_ms, back on, wait b_ms
+#define STEP_RESETS 1  // count x (wait a_ms, test mode, wait b_ms, reset error)
+#define STEP_WRITE  2  // MSG with error cleared and checksums fixed, written and verified
+
+struct UnlockStep {
+  uint8_t op;      // STEP_*
+  uint8_t count;
+  uint16_t a_ms;
+  uint16_t b_ms;
+};
+
+struct UnlockStrategy {
+  const char* name;  // PROGMEM
+  uint8_t first;     // Index of the first step
+  uint8_t steps;
+  uint8_t repeat;    // Lock check after each
+};
+
+#define UNLOCK_STRATEGIES 3
+#define UNLOCK_ERR_UNKNOWN 0xFF  // Error code key when the MSG could not be read
+#define UNLOCK_CHIP_RACK   0x80  // Chip key of rack slots - family not probed there
+
+void strategy_get(uint8_t idx, UnlockStrategy* s);
+void strategy_step(uint8_t idx, UnlockStep* st);
+bool strategy_writes(const UnlockStrategy* s);  // Has a STEP_WRITE, needs the MSG
+
+// Strategy indexes for this key: fastest mean success first, then untried
+// ones, then ones that never worked, each in table order
+void strategy_order(uint8_t chip, uint8_t error, uint8_t* order);
+
+// One finished strategy run (not recorded when cancelled)
+void strategy_record(uint8_t chip, uint8_t error, uint8_t idx, bool won, uint32_t ms);
+
+// Advanced menu
+void printStrategyStats();
+
+#endif
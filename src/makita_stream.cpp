@@ -0,0 +1,218 @@
+/*
+ * Makita Battery Reader - Telemetry Streaming
+ */
+
+#include "makita_stream.h"
+#include "makita_chip.h"
+#include "makita_comm.h"
+#include "makita_commands.h"
+#include "makita_data.h"
+#include "makita_host.h"
+#include "makita_print.h"
+#include "makita_task.h"
+
+static Task stream_task;
+static Task stream_wake;
+static bool stream_running = false;
+static bool stream_stop = false;
+static uint8_t stream_mode;
+static uint16_t stream_interval;
+
+static uint16_t stream_seq;
+static uint32_t stream_start_ms;
+static uint32_t stream_next;
+static uint32_t stream_samples;
+static uint32_t stream_dropped;
+
+// ============== Acquisition ==============
+
+static bool stream_read(Telemetry* s) {
+  return chip_telemetry(s);
+}
+
+// ============== Output ==============
+
+static void printTemp(int16_t t) {
+  Serial.print(',');
+  if (t != TEMP_NONE) Serial.print(t);
+}
+
+static void stream_emit(const Telemetry* s, uint32_t t_ms) {
+  if (stream_mode == STREAM_HOST) {
+    // seq | t_ms | cells | mv[cells] | t_cell | t_mosfet
+    hostBegin(HOST_EVT_STREAM, HOST_OK, 2 + 4 + 1 + 2 * s->cell_count + 4);
+    hostWrite((const byte*)&stream_seq, 2);
+    hostWrite((const byte*)&t_ms, 4);
+    hostWrite(&s->cell_count, 1);
+    hostWrite((const byte*)s->cell_mv, 2 * s->cell_count);
+    hostWrite((const byte*)&s->t_cell, 2);
+    hostWrite((const byte*)&s->t_mosfet, 2);
+    hostEnd();
+    return;
+  }
+
+  Serial.print(t_ms);
+  Serial.print(',');
+  Serial.print(stream_seq);
+  for (uint8_t i = 0; i < s->cell_count; i++) {
+    Serial.print(',');
+    Serial.print(s->cell_mv[i]);
+  }
+  printTemp(s->t_cell);
+  printTemp(s->t_mosfet);
+  Serial.println();
+}
+
+static void stream_summary() {
+  uint32_t elapsed = millis() - stream_start_ms;
+
+  if (stream_mode == STREAM_HOST) {
+    // samples | dropped | elapsed_ms
+    hostBegin(HOST_CMD_STREAM, HOST_OK, 12);
+    hostWrite((const byte*)&stream_samples, 4);
+    hostWrite((const byte*)&stream_dropped, 4);
+    hostWrite((const byte*)&elapsed, 4);
+    hostEnd();
+    return;
+  }
+
+  Serial.print(F("# Stopped: "));
+  Serial.print(stream_samples);
+  Serial.print(F(" samples in "));
+  Serial.print(elapsed);
+  Serial.print(F(" ms ("));
+  printFixed(elapsed ? (uint64_t)stream_samples * 100000 / elapsed : 0, 2);
+  Serial.print(F("/s), dropped "));
+  Serial.println(stream_dropped);
+}
+
+// ============== Task ==============
+
+static uint8_t stream_steps(Task* t) {
+  Telemetry s;
+
+  TASK_BEGIN(t);
+
+  // Pack type decides the command set
+  if (!g_battery.valid) {
+    if (!bus_awake()) TASK_AWAIT(t, &stream_wake, bus_wake_task, NULL);
+    if (!readAllBatteryData()) {
+      if (stream_mode == STREAM_TEXT) Serial.println(F("ERROR: Failed to read battery data"));
+      stream_summary();
+      stream_running = false;
+      TASK_EXIT(t);
+    }
+  }
+
+  if (stream_mode == STREAM_TEXT) {
+    Serial.println(F("# time_ms,seq,cell_mV...,t_cell_dC,t_mosfet_dC - 'x' stops"));
+  }
+
+  stream_start_ms = millis();
+  stream_next = stream_start_ms;
+
+  while (!stream_stop) {
+    // Kept awake between samples; a pack that still dropped off is woken
+    // without blocking the other tasks
+    if (!bus_awake() && !bus_poll_rom()) TASK_AWAIT(t, &stream_wake, bus_wake_task, NULL);
+
+    if (stream_read(&s)) {
+      stream_emit(&s, millis() - stream_start_ms);
+      stream_samples++;
+    } else {
+      stream_dropped++;
+    }
+    stream_seq++;
+
+    // Next slot; slots that passed entirely while busy are dropped
+    stream_next += stream_interval;
+    while (stream_interval && (int32_t)(millis() - (stream_next + stream_interval)) >= 0) {
+      stream_next += stream_interval;
+      stream_dropped++;
+      stream_seq++;
+    }
+    if (!stream_interval) stream_next = millis();
+
+    // Sleep in steps short enough for the session to stay alive
+    for (;;) {
+      TASK_SLEEP_UNTIL(t, (int32_t)(stream_next - millis()) > BUS_KEEPALIVE_MS ? millis() + BUS_KEEPALIVE_MS
+                                                                               : stream_next);
+      if (stream_stop || (int32_t)(millis() - stream_next) >= 0) break;
+      bus_keep_alive();
+    }
+  }
+
+  stream_summary();
+  stream_running = false;
+  TASK_END(t);
+}
+
+// A cancel ends the steps in whatever sleep they are in - the summary
+// still follows
+static uint8_t streamTask(Task* t) {
+  uint8_t r = stream_steps(t);
+
+  if (r == TASK_CANCELLED) {
+    stream_summary();
+    stream_running = false;
+  }
+  return r;
+}
+
+bool streamStart(uint16_t interval_ms, uint8_t mode) {
+  if (stream_running) return false;
+
+  stream_mode = mode;
+  stream_interval = interval_ms;
+  stream_stop = false;
+  stream_seq = 0;
+  stream_samples = 0;
+  stream_dropped = 0;
+
+  if (!taskStart(&stream_task, streamTask, NULL)) return false;
+  stream_running = true;
+  return true;
+}
+
+void streamStop() {
+  if (!stream_running) return;
+  stream_stop = true;
+  stream_task.wake = millis();  // Don't wait out a long interval
+}
+
+bool streamActive() {
+  return stream_running;
+}
+
+// ============== Menu ==============
+
+void streamMenu() {
+  char buf[6];
+  uint8_t idx = 0;
+
+  Serial.println(F("\nSample interval in ms (0 = as fast as possible), 'c' to cancel:"));
+
+  while (true) {
+    hal_idle();  // Returns at once if a key is waiting
+    if (Serial.available()) {
+      char c = Serial.read();
+      if (c == 'c' || c == 'C') {
+        Serial.println(F("Cancelled"));
+        return;
+      }
+      if (c == '\r' || c == '\n') {
+        if (idx > 0) break;
+      } else if (c >= '0' && c <= '9' && idx < 5) {
+        buf[idx++] = c;
+        Serial.print(c);
+      }
+    }
+  }
+  buf[idx] = '\0';
+  Serial.println();
+
+  long interval = atol(buf);
+  if (interval > 60000) interval = 60000;
+
+  streamStart((uint16_t)interval, STREAM_TEXT);
+}
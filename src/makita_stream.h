@@ -0,0 +1,26 @@
+/*
+ * Makita Battery Reader - Telemetry Streaming
+ *
+ * Samples cell voltages and temperatures at a fixed interval as a background
+ * task and emits one record per sample, either as a CSV line or as a host
+ * frame. Interval 0 samples as fast as the bus and the serial port allow.
+ * Samples whose whole slot passed while the previous one was still being
+ * read or sent are counted as dropped, as are failed reads.
+ */
+
+#ifndef MAKITA_STREAM_H
+#define MAKITA_STREAM_H
+
+#include "config.h"
+
+#define STREAM_TEXT 0  // CSV lines
+#define STREAM_HOST 1  // HOST_EVT_STREAM frames
+
+bool streamStart(uint16_t interval_ms, uint8_t mode);
+void streamStop();    // Summary follows once the current sample is done
+bool streamActive();
+
+// Menu: ask for the interval and start a text stream
+void streamMenu();
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Makita Battery Reader - Cooperative Task Scheduler
+ */
+
+#include "makita_task.h"
+
+volatile bool g_task_cancel = false;
+
+static Task* slots[TASK_SLOTS];
+static void (*idle_hook)() = 0;
+static uint8_t wait_depth = 0;
+
+static inline bool taskDue(const Task* t) {
+  return (int32_t)(millis() - t->wake) >= 0;
+}
+
+void taskInit(Task* t, TaskFn fn, void* arg) {
+  t->fn = fn;
+  t->pc = 0;
+  t->wake = millis();
+  t->i = 0;
+  t->j = 0;
+  t->arg = arg;
+}
+
+// ============== Background scheduling ==============
+
+bool taskStart(Task* t, TaskFn fn, void* arg) {
+  for (uint8_t s = 0; s < TASK_SLOTS; s++) {
+    if (!slots[s]) {
+      taskInit(t, fn, arg);
+      slots[s] = t;
+      g_task_cancel = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t taskRun() {
+  uint8_t ended = TASK_WAITING;
+
+  for (uint8_t s = 0; s < TASK_SLOTS; s++) {
+    Task* t = slots[s];
+    if (!t || !taskDue(t)) continue;
+
+    uint8_t r = t->fn(t);
+    if (r != TASK_WAITING) {
+      slots[s] = 0;
+      ended = r;
+    }
+  }
+
+  if (ended != TASK_WAITING && !taskBusy()) g_task_cancel = false;
+  return ended;
+}
+
+bool taskBusy() {
+  for (uint8_t s = 0; s < TASK_SLOTS; s++) {
+    if (slots[s]) return true;
+  }
+  return false;
+}
+
+void taskCancel() {
+  g_task_cancel = true;
+}
+
+// ============== Blocking execution ==============
+
+void taskSetIdleHook(void (*hook)()) {
+  idle_hook = hook;
+}
+
+uint8_t taskWait(TaskFn fn, void* arg) {
+  Task t;
+  uint8_t r;
+
+  taskInit(&t, fn, arg);
+  wait_depth++;
+
+  while ((r = fn(&t)) == TASK_WAITING) {
+    while (!taskDue(&t)) {
+      if (idle_hook) idle_hook();
+      delay(1);
+    }
+  }
+
+  // A cancel requested during a blocking call ends with that call
+  if (--wait_depth == 0 && !taskBusy()) g_task_cancel = false;
+  return r;
+}
@@ -0,0 +1,89 @@
+/*
+ * Makita Battery Reader - Cooperative Task Scheduler
+ *
+ * Long bus sequences are written as resumable tasks (protothread style).
+ * A task function returns TASK_WAITING whenever it sleeps and is re-entered
+ * at the same line once its deadline has passed, so loop() keeps serving the
+ * host in between. Locals do not survive a sleep - keep loop counters in
+ * Task::i / Task::j and buffers in statics.
+ *
+ *   uint8_t my_task(Task* t) {
+ *     TASK_BEGIN(t);
+ *     set_enablepin(false);
+ *     TASK_SLEEP(t, 200);
+ *     set_enablepin(true);
+ *     TASK_END(t);
+ *   }
+ *
+ * taskWait() runs a task to completion for callers that want the old
+ * blocking behaviour; cancellation still works through the idle hook.
+ */
+
+#ifndef MAKITA_TASK_H
+#define MAKITA_TASK_H
+
+#include "config.h"
+
+#define TASK_WAITING   0
+#define TASK_DONE      1
+#define TASK_CANCELLED 2
+
+#define TASK_SLOTS 2
+
+struct Task;
+typedef uint8_t (*TaskFn)(Task* t);
+
+struct Task {
+  TaskFn fn;
+  uint16_t pc;     // Resume line, 0 = start
+  uint32_t wake;   // millis() deadline
+  int16_t i;       // Loop counters that survive sleeps
+  int16_t j;
+  void* arg;
+};
+
+extern volatile bool g_task_cancel;
+
+#define TASK_BEGIN(t) switch ((t)->pc) { case 0:
+
+// Sleep until an absolute millis() deadline
+#define TASK_SLEEP_UNTIL(t, when)                                \
+  do {                                                           \
+    (t)->wake = (when);                                          \
+    (t)->pc = __LINE__;                                          \
+    return TASK_WAITING;                                         \
+    case __LINE__:                                               \
+    if (g_task_cancel) { (t)->pc = 0; return TASK_CANCELLED; }   \
+  } while (0)
+
+#define TASK_SLEEP(t, ms) TASK_SLEEP_UNTIL(t, millis() + (ms))
+
+// Run child task c with function f to completion, sleeping with it
+#define TASK_AWAIT(t, c, f, a)                                   \
+  do {                                                           \
+    taskInit((c), (f), (a));                                     \
+    (t)->pc = __LINE__;                                          \
+    case __LINE__: {                                             \
+      uint8_t r_ = (c)->fn(c);                                   \
+      if (r_ == TASK_WAITING) { (t)->wake = (c)->wake; return TASK_WAITING; } \
+      if (r_ == TASK_CANCELLED) { (t)->pc = 0; return TASK_CANCELLED; }       \
+    }                                                            \
+  } while (0)
+
+#define TASK_EXIT(t) do { (t)->pc = 0; return TASK_DONE; } while (0)
+
+#define TASK_END(t) } (t)->pc = 0; return TASK_DONE;
+
+void taskInit(Task* t, TaskFn fn, void* arg);
+
+// Background scheduling from loop()
+bool taskStart(Task* t, TaskFn fn, void* arg);
+uint8_t taskRun();    // TASK_DONE / TASK_CANCELLED when a task just ended
+bool taskBusy();
+void taskCancel();
+
+// Blocking execution; the idle hook runs while waiting for deadlines
+uint8_t taskWait(TaskFn fn, void* arg);
+void taskSetIdleHook(void (*hook)());
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Makita Battery Reader - Bus Timing Calibration
+ */
+
+#include "makita_timing.h"
+#include "makita_comm.h"
+#include "makita_commands.h"
+#include "makita_print.h"
+#include "makita_profile.h"
+
+// Search parameters
+#define CAL_STEP   10  // Percent per step
+#define CAL_ROUNDS 4   // Reads of each command per step
+
+static uint8_t session_pct = TIMING_DEFAULT;
+static bool calibrating = false;
+
+// ============== Scaling ==============
+
+// Scale the part of a default above its floor
+static uint16_t scale_us(uint16_t def, uint16_t floor, uint8_t pct) {
+  if (def <= floor) return def;
+  return floor + (uint32_t)(def - floor) * pct / 100;
+}
+
+// Only recovery and hold times shrink; the read sample point and the
+// write-1 low pulse stay as they are. Floors are the 1-Wire minimums.
+void timing_apply(uint8_t pct) {
+  HalTiming t;
+  hal_default_timing(&t);
+
+  t.reset_low = scale_us(t.reset_low, 480, pct);
+  t.reset_tail = scale_us(t.reset_tail, 240, pct);
+  t.w1_high = scale_us(t.w1_high, 5, pct);
+  t.w0_low = scale_us(t.w0_low, 20, pct);
+  t.w0_high = scale_us(t.w0_high, 5, pct);
+  t.r_tail = scale_us(t.r_tail, 5, pct);
+
+  hal_set_timing(&t);
+  session_pct = pct;
+}
+
+uint8_t timing_percent() {
+  return session_pct;
+}
+
+void timing_fallback() {
+  if (!calibrating && session_pct != TIMING_DEFAULT) {
+    timing_apply(TIMING_DEFAULT);
+  }
+}
+
+void timing_apply_for_rom(const byte* rom) {
+  PackProfile p;
+  profile_load(rom, &p);
+  timing_apply(p.timing_pct);
+}
+
+// ============== Calibration ==============
+
+// Single-shot reads (no retries) must match the reference every time
+static bool cal_verify(const byte* ref_model, const byte* ref_charger, uint8_t rounds) {
+  for (uint8_t i = 0; i < rounds; i++) {
+    if (!cmd_once(CMD_MODEL, g_buf) || memcmp(g_buf, ref_model, 10) != 0) return false;
+  }
+  for (uint8_t i = 0; i < rounds; i++) {
+    if (!cmd_once(CMD_CHARGER, g_buf) || memcmp(g_buf, ref_charger, 40) != 0) return false;
+  }
+  return true;
+}
+
+static uint32_t time_charger_read() {
+  uint32_t t0 = micros();
+  charger_33_cmd(g_buf);
+  return micros() - t0;
+}
+
+static void printPercent(uint8_t pct) {
+  if (pct < 100) Serial.print(' ');
+  if (pct < 10) Serial.print(' ');
+  Serial.print(pct);
+  Serial.print('%');
+}
+
+static void printSlotUs(const __FlashStringHelper* label, uint32_t before, uint32_t after) {
+  Serial.print(label);
+  Serial.print(before);
+  Serial.print(F(" -> "));
+  Serial.print(after);
+  Serial.println(F(" us"));
+}
+
+static uint16_t read_byte_us(const HalTiming* t) {
+  return 8 * (t->r_low + t->r_sample + t->r_tail);
+}
+
+// Average of a byte with four ones and four zeros
+static uint16_t write_byte_us(const HalTiming* t) {
+  return 4 * (t->w1_low + t->w1_high + t->w0_low + t->w0_high);
+}
+
+void calibrateTiming() {
+  byte ref_model[10];
+  byte ref_charger[40];
+  HalTiming def, cal;
+  uint8_t good, pct;
+  uint32_t us_before, us_after;
+
+  printSeparator();
+  Serial.println(F("  BUS TIMING CALIBRATION"));
+  printSeparator();
+
+  // Reference at default timings, with the usual retries
+  timing_apply(TIMING_DEFAULT);
+  bus_ensure_awake();
+  if (!try_charger(ref_charger)) {
+    Serial.println(F("ERROR: No response at default timing"));
+    return;
+  }
+  if (!model_cmd(ref_model)) {
+    Serial.println(F("ERROR: Model read failed at default timing"));
+    return;
+  }
+  us_before = time_charger_read();
+
+  Serial.print(F("ROM: "));
+  printHexArray(ref_charger, 8);
+  Serial.println();
+
+  calibrating = true;
+  good = TIMING_DEFAULT;
+
+  for (pct = TIMING_DEFAULT - CAL_STEP; pct <= TIMING_DEFAULT; pct -= CAL_STEP) {
+    timing_apply(pct);
+    bool ok = cal_verify(ref_model, ref_charger, CAL_ROUNDS);
+    printPercent(pct);
+    Serial.println(ok ? F(": OK") : F(": FAIL"));
+    if (!ok) break;
+    good = pct;
+  }
+
+  // One step of margin, confirmed with a longer run
+  pct = good;
+  if (pct < TIMING_DEFAULT) pct += CAL_STEP;
+  for (;;) {
+    timing_apply(pct);
+    if (pct >= TIMING_DEFAULT || cal_verify(ref_model, ref_charger, 2 * CAL_ROUNDS)) break;
+    pct += CAL_STEP;
+  }
+  calibrating = false;
+
+  us_after = time_charger_read();
+
+  hal_default_timing(&def);
+  hal_get_timing(&cal);
+
+  Serial.print(F("Selected: "));
+  Serial.print(pct);
+  Serial.println(F("% of default recovery times"));
+  printSlotUs(F("Reset:      "), def.reset_low + def.reset_sample + def.reset_tail,
+              cal.reset_low + cal.reset_sample + cal.reset_tail);
+  printSlotUs(F("Write byte: "), write_byte_us(&def), write_byte_us(&cal));
+  printSlotUs(F("Read byte:  "), read_byte_us(&def), read_byte_us(&cal));
+  printSlotUs(F("charger_33: "), us_before, us_after);
+
+  PackProfile p;
+  profile_load(ref_charger, &p);
+  p.timing_pct = pct;
+  profile_save(&p);
+  Serial.println(F("Saved for this battery (ROM ID)."));
+}
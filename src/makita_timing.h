@@ -0,0 +1,27 @@
+/*
+ * Makita Battery Reader - Bus Timing Calibration
+ *
+ * The default slot timings are sized for the slowest chip. Calibration walks
+ * the recovery parts of every slot down from 100% (default) towards the
+ * 1-Wire minimums, checks each step with repeated model and charger reads,
+ * and keeps the shortest step that passed plus one step of margin. The
+ * result is stored in the pack's profile (makita_profile).
+ */
+
+#ifndef MAKITA_TIMING_H
+#define MAKITA_TIMING_H
+
+#include "config.h"
+
+#define TIMING_DEFAULT 100  // Percent of the default recovery times
+
+// Session timing
+void timing_apply(uint8_t pct);
+uint8_t timing_percent();
+void timing_apply_for_rom(const byte* rom);  // Stored profile or default
+void timing_fallback();                      // Back to default after a failed read
+
+// Menu
+void calibrateTiming();
+
+#endif
@@ -3,15 +3,64 @@
  */
 
 #include "makita_unlock.h"
+#include "makita_chip.h"
 #include "makita_comm.h"
 #include "makita_commands.h"
 #include "makita_data.h"
+#include "makita_msg.h"
 #include "makita_print.h"
+#include "makita_stats.h"
+#include "makita_strategy.h"
 
 // Clear error code and recalculate checksums (the right way to unlock!)
 static void clearErrorWithChecksum(byte* msg) {
-  msg[20] &= 0xF0;  // Clear error code (nybble 40)
-  recalcMsgChecksums(msg);
+  MsgView v(msg);
+  v.set(MSG_ERROR, MSG_ERR_OK);
+  v.fixChecksums();
+}
+
+// Primary checksums as "1/2/3"
+static void printChecksums(ConstMsgView msg) {
+  Serial.print(msg.get(MSG_CHK1), HEX);
+  Serial.print(F("/"));
+  Serial.print(msg.get(MSG_CHK2), HEX);
+  Serial.print(F("/"));
+  Serial.println(msg.get(MSG_CHK3), HEX);
+}
+
+static void printResult(ConstMsgView msg) {
+  Serial.print(F("Result: err=0x"));
+  Serial.print(msg.get(MSG_ERROR), HEX);
+  Serial.print(F(" chksum="));
+  Serial.println(msg.get(MSG_CHK3), HEX);
+}
+
+// Which nybbles the last write changed, and whether it stuck
+static void printWriteResult(bool verified) {
+  const byte* changed = msg_write_changes();
+
+  if (msg_write_skipped()) {
+    Serial.println(F("MSG unchanged, nothing written"));
+    return;
+  }
+  if (changed) {
+    Serial.print(F("Changed nybbles:"));
+    for (uint8_t n = 0; n < 64; n++) {
+      if (!(changed[n >> 3] & (1 << (n & 7)))) continue;
+      Serial.print(' ');
+      Serial.print(n);
+    }
+    Serial.println();
+  }
+  Serial.println(verified ? F("MSG written and verified") : F("WARNING: MSG read-back does not match"));
+}
+
+// One key from the terminal, sleeping until it arrives; the rest of the line is dropped
+static char readKey() {
+  while (!Serial.available()) hal_idle();
+  char c = Serial.read();
+  while (Serial.available()) Serial.read();
+  return c;
 }
 
 // ============== MSG storage ==============
@@ -32,10 +81,14 @@ void saveMSG() {
   msg_saved = true;
 
   Serial.println(F("MSG saved."));
-  Serial.print(F("  err=0x")); Serial.print(saved_msg[20] & 0x0F, HEX);
-  Serial.print(F(" chksum=")); Serial.println(saved_msg[21] >> 4, HEX);
-  int cycles = ((int)SWAP_NIBBLES(saved_msg[27])) | ((int)SWAP_NIBBLES(saved_msg[26])) << 8;
-  Serial.print(F("  cycles=")); Serial.println(cycles & 0x0FFF);
+  ConstMsgView msg(saved_msg);
+  Serial.print(F("  err=0x")); Serial.print(msg.get(MSG_ERROR), HEX);
+  Serial.print(F(" chksum=")); Serial.println(msg.get(MSG_CHK3), HEX);
+  Serial.print(F("  cycles=")); Serial.println(msg.get(MSG_CYCLES));
+}
+
+const byte* savedMSG() {
+  return msg_saved ? saved_msg : NULL;
 }
 
 void compareMSG() {
@@ -90,9 +143,7 @@ void cloneMSG() {
   Serial.println(F("This writes saved MSG to current battery."));
   Serial.println(F("Press 'y' to confirm:"));
 
-  while (!Serial.available()) delay(10);
-  char c = Serial.read();
-  while (Serial.available()) Serial.read();
+  char c = readKey();
 
   if (c != 'y' && c != 'Y') {
     Serial.println(F("Cancelled"));
@@ -105,16 +156,12 @@ void cloneMSG() {
   clearErrorWithChecksum(clone_msg);
 
   Serial.println(F("Writing with valid checksums..."));
-  write_msg_to_eeprom(clone_msg);
+  printWriteResult(write_msg_to_eeprom(clone_msg));
 
   // Verify
   byte data[48];
   if (try_charger(data)) {
-    byte* msg = data + 8;
-    Serial.print(F("Result: err=0x"));
-    Serial.print(msg[20] & 0x0F, HEX);
-    Serial.print(F(" chksum="));
-    Serial.println(msg[21] >> 4, HEX);
+    printResult(ConstMsgView(data + 8));
   }
   Serial.println(F("Done."));
 }
@@ -132,102 +179,127 @@ void resetBatteryErrors() {
   Serial.println(F("\nReset complete."));
 }
 
-void unlockBattery() {
-  printSeparator();
-  Serial.println(F("     AGGRESSIVE BATTERY UNLOCK"));
-  printSeparator();
-
-  // Phase 1: Standard reset commands
-  Serial.println(F("\nPhase 1: Standard reset..."));
-  for (int cycle = 0; cycle < 5; cycle++) {
-    Serial.print(F("  Cycle "));
-    Serial.print(cycle + 1);
-
-    trigger_power();
-    for (int i = 0; i < 5; i++) {
-      delay(200);
-      testmode_cmd();
-      reset_error_cmd();
-      Serial.print('.');
-    }
-    Serial.println();
-
-    if (!isBatteryLocked()) {
-      Serial.println(F("\n*** SUCCESS: Battery unlocked! ***"));
-      return;
-    }
-  }
-
-  // Phase 2: Clear error with checksum recalculation (per protocol docs)
-  Serial.println(F("\nPhase 2: Clearing EEPROM with checksum fix..."));
-
-  byte charger_data[48];
-  memset(charger_data, 0, 48);
+static void printUnlockSuccess() {
+  Serial.println(F("\n*** SUCCESS: Battery unlocked! ***"));
+}
 
-  if (try_charger(charger_data)) {
-    byte* raw_msg = charger_data + 8;
+// Unlock run state - must survive task sleeps
+static byte unlock_msg[32];
+static uint8_t unlock_order[UNLOCK_STRATEGIES];
+static uint8_t unlock_chip, unlock_error;
+static bool unlock_learn;  // Locked at the start - worth recording
+static UnlockStrategy unlock_strat;
+static UnlockStep unlock_step;
+static uint8_t unlock_pos, unlock_n;
+static uint32_t unlock_t0;
+
+// MSG for the write steps: read now, error cleared, checksums fixed
+static bool unlockPrepareMsg() {
+  memset(g_buf, 0, 48);
+  if (!try_charger(g_buf)) return false;
+  memcpy(unlock_msg, g_buf + 8, 32);
+  clearErrorWithChecksum(unlock_msg);
+  Serial.print(F("  New checksums: "));
+  printChecksums(ConstMsgView(unlock_msg));
+  return true;
+}
 
-    // Clear error code and recalculate checksums (the correct way!)
-    clearErrorWithChecksum(raw_msg);
+// Runs the strategies of makita_strategy in learned order
+uint8_t unlockBatteryTask(Task* t) {
+  static Task child;
 
-    Serial.print(F("  New checksums: "));
-    Serial.print(raw_msg[20] >> 4, HEX);
-    Serial.print(F("/"));
-    Serial.print(raw_msg[21] & 0x0F, HEX);
-    Serial.print(F("/"));
-    Serial.println(raw_msg[21] >> 4, HEX);
+  TASK_BEGIN(t);
 
-    for (int attempt = 0; attempt < 3; attempt++) {
-      Serial.print(F("  Write "));
-      Serial.print(attempt + 1);
+  printSeparator();
+  Serial.println(F("     AGGRESSIVE BATTERY UNLOCK"));
+  printSeparator();
+  Serial.println(F("Press 'x' to cancel."));
+
+  // Key for the statistics: chip family and error code
+  unlock_chip = chip_family();
+  unlock_error = UNLOCK_ERR_UNKNOWN;
+  unlock_learn = false;
+  memset(g_buf, 0, 48);
+  if (try_charger(g_buf)) {
+    ConstMsgView msg(g_buf + 8);
+    unlock_error = msg.get(MSG_ERROR);
+    unlock_learn = msg.errorLocks() || !msg.checksumsOk();
+  }
+  strategy_order(unlock_chip, unlock_error, unlock_order);
+
+  for (unlock_pos = 0; unlock_pos < UNLOCK_STRATEGIES; unlock_pos++) {
+    strategy_get(unlock_order[unlock_pos], &unlock_strat);
+    Serial.print(F("\nPhase "));
+    Serial.print(unlock_pos + 1);
+    Serial.print(F(": "));
+    Serial.print(reinterpret_cast<const __FlashStringHelper*>(unlock_strat.name));
+    Serial.println(F("..."));
 
-      write_msg_to_eeprom(raw_msg);
+    unlock_t0 = millis();
+    if (strategy_writes(&unlock_strat) && !unlockPrepareMsg()) {
+      Serial.println(F("  Cannot read MSG - skipped"));
+      continue;
+    }
 
-      // Full power cycle to commit EEPROM
-      Serial.print(F(" power cycle..."));
-      set_enablepin(false);
-      delay(2000);
-      set_enablepin(true);
-      delay(1000);
+    for (t->i = 0; t->i < unlock_strat.repeat; t->i++) {
+      Serial.print(F("  Cycle "));
+      Serial.print(t->i + 1);
+
+      for (t->j = 0; t->j < unlock_strat.steps; t->j++) {
+        strategy_step(unlock_strat.first + t->j, &unlock_step);
+
+        // No switch here - the task macros are case labels
+        if (unlock_step.op == STEP_POWER) {
+          set_enablepin(false);
+          TASK_SLEEP(t, unlock_step.a_ms);
+          set_enablepin(true);
+          TASK_SLEEP(t, unlock_step.b_ms);
+        } else if (unlock_step.op == STEP_RESETS) {
+          for (unlock_n = 0; unlock_n < unlock_step.count; unlock_n++) {
+            TASK_SLEEP(t, unlock_step.a_ms);
+            testmode_cmd();
+            if (unlock_step.b_ms) TASK_SLEEP(t, unlock_step.b_ms);
+            reset_error_cmd();
+            Serial.print('.');
+          }
+        } else if (unlock_step.op == STEP_WRITE) {
+          Serial.print(F(" write"));
+          TASK_AWAIT(t, &child, write_msg_task, unlock_msg);
+          if (msg_write_skipped()) Serial.print(F(" unchanged"));
+        }
+      }
 
       if (!isBatteryLocked()) {
-        Serial.println(F("\n*** SUCCESS: Battery unlocked! ***"));
-        return;
+        Serial.println();
+        if (unlock_learn) {
+          strategy_record(unlock_chip, unlock_error, unlock_order[unlock_pos], true, millis() - unlock_t0);
+        }
+        printUnlockSuccess();
+        TASK_EXIT(t);
       }
       Serial.println(F(" still locked"));
     }
-  }
 
-  // Phase 3: Extended power cycling
-  Serial.println(F("\nPhase 3: Power cycling..."));
-  for (int cycle = 0; cycle < 3; cycle++) {
-    set_enablepin(false);
-    delay(2000);
-    set_enablepin(true);
-    delay(1000);
-
-    for (int i = 0; i < 10; i++) {
-      testmode_cmd();
-      delay(100);
-      reset_error_cmd();
-      delay(100);
-    }
-
-    if (!isBatteryLocked()) {
-      Serial.println(F("\n*** SUCCESS: Battery unlocked! ***"));
-      return;
+    if (unlock_learn) {
+      strategy_record(unlock_chip, unlock_error, unlock_order[unlock_pos], false, 0);
     }
   }
 
   Serial.println(F("\nUnlock failed. May need cell charging or PCB replacement."));
+  TASK_END(t);
+}
+
+void unlockBattery() {
+  if (taskWait(unlockBatteryTask, NULL) == TASK_CANCELLED) {
+    set_enablepin(true);
+    Serial.println(F("\nCancelled."));
+  }
 }
 
 void factoryResetBattery() {
   Serial.println(F("\nFactory Reset: 1=minimal, 2=0xC1, 3=0x94, 0=cancel"));
 
-  while (!Serial.available()) delay(10);
-  char opt = Serial.read();
-  while (Serial.available()) Serial.read();
+  char opt = readKey();
 
   if (opt == '0') { Serial.println(F("Cancelled")); return; }
 
@@ -243,20 +315,12 @@ void factoryResetBattery() {
   clearErrorWithChecksum(msg);
 
   Serial.print(F("Checksums: "));
-  Serial.print(msg[20] >> 4, HEX);
-  Serial.print(F("/"));
-  Serial.print(msg[21] & 0x0F, HEX);
-  Serial.print(F("/"));
-  Serial.println(msg[21] >> 4, HEX);
+  printChecksums(ConstMsgView(msg));
 
-  write_msg_to_eeprom(msg);
+  printWriteResult(write_msg_to_eeprom(msg));
 
   if (try_charger(data)) {
-    msg = data + 8;
-    Serial.print(F("Result: err=0x"));
-    Serial.print(msg[20] & 0x0F, HEX);
-    Serial.print(F(" chksum="));
-    Serial.println(msg[21] >> 4, HEX);
+    printResult(ConstMsgView(data + 8));
   }
   Serial.println(F("Done."));
 }
@@ -270,12 +334,11 @@ void resetCycleCount() {
   }
 
   byte* msg = data + 8;
+  MsgView v(msg);
 
   // Show current cycle count
-  int old_count = ((int)SWAP_NIBBLES(msg[27])) | ((int)SWAP_NIBBLES(msg[26])) << 8;
-  old_count &= 0x0FFF;
   Serial.print(F("Current cycles: "));
-  Serial.println(old_count);
+  Serial.println(v.get(MSG_CYCLES));
 
   // Ask for new value
   Serial.println(F("Enter new cycle count (0-4095), or 'c' to cancel:"));
@@ -284,6 +347,7 @@ void resetCycleCount() {
   char buf[8];
   int idx = 0;
   while (true) {
+    hal_idle();  // Returns at once if a key is waiting
     if (Serial.available()) {
       char c = Serial.read();
       if (c == 'c' || c == 'C') {
@@ -307,20 +371,15 @@ void resetCycleCount() {
   Serial.print(F("Setting cycles to: "));
   Serial.println(new_cycles);
 
-  // Encode cycle count (swap nibbles format)
-  msg[26] = SWAP_NIBBLES((new_cycles >> 8) & 0xFF);
-  msg[27] = SWAP_NIBBLES(new_cycles & 0xFF);
+  v.set(MSG_CYCLES, new_cycles);
 
   // Write to EEPROM (safe write recalculates checksums including chk5 for cycle count)
-  write_msg_safe(msg);
+  printWriteResult(write_msg_safe(msg));
 
   // Verify
   if (try_charger(data)) {
-    msg = data + 8;
-    int verify_count = ((int)SWAP_NIBBLES(msg[27])) | ((int)SWAP_NIBBLES(msg[26])) << 8;
-    verify_count &= 0x0FFF;
     Serial.print(F("Verified: "));
-    Serial.println(verify_count);
+    Serial.println(ConstMsgView(data + 8).get(MSG_CYCLES));
   }
   Serial.println(F("Done."));
 }
@@ -359,7 +418,7 @@ void resetHandshakeState() {
   if (try_charger(rsp)) {
     byte* msg = rsp + 8;
     clearErrorWithChecksum(msg);
-    write_msg_to_eeprom(msg);
+    printWriteResult(write_msg_to_eeprom(msg));
   }
 
   Serial.println(F("[4] Final power cycle..."));
@@ -381,9 +440,7 @@ void lockBatteryForTest() {
   Serial.println(F("  4 - err=F Dead"));
   Serial.println(F("  0 - Cancel"));
 
-  while (!Serial.available()) delay(10);
-  char opt = Serial.read();
-  while (Serial.available()) Serial.read();
+  char opt = readKey();
 
   if (opt == '0') {
     Serial.println(F("Cancelled"));
@@ -402,34 +459,31 @@ void lockBatteryForTest() {
   }
 
   byte* msg = data + 8;
+  MsgView v(msg);
 
   Serial.print(F("Current err=0x"));
-  Serial.print(msg[20] & 0x0F, HEX);
+  Serial.print(v.get(MSG_ERROR), HEX);
   Serial.print(F(" chk="));
-  Serial.print(msg[20] >> 4, HEX);
-  Serial.print(F("/"));
-  Serial.print(msg[21] & 0x0F, HEX);
-  Serial.print(F("/"));
-  Serial.println(msg[21] >> 4, HEX);
+  printChecksums(ConstMsgView(msg));
 
   if (opt == '1') {
     // Corrupt checksum3 (nybble 43) - flip bits
-    msg[21] ^= 0xF0;
+    v.set(MSG_CHK3, v.get(MSG_CHK3) ^ 0x0F);
     Serial.println(F("Corrupting checksum..."));
-    write_msg_to_eeprom(msg);  // Raw write, no recalc
+    printWriteResult(write_msg_to_eeprom(msg));  // Raw write, no recalc
   } else {
     // Set error code based on option
     byte err_code = 0;
     switch (opt) {
-      case '2': err_code = 0x01; break;  // Overloaded
-      case '3': err_code = 0x05; break;  // Warning
+      case '2': err_code = MSG_ERR_OVERLOADED; break;
+      case '3': err_code = MSG_ERR_WARNING; break;
       case '4': err_code = 0x0F; break;  // Dead
     }
-    msg[20] = (msg[20] & 0xF0) | err_code;
+    v.set(MSG_ERROR, err_code);
     Serial.print(F("Setting error=0x"));
     Serial.print(err_code, HEX);
     Serial.println(F("..."));
-    write_msg_safe(msg);  // Recalc checksums with error set
+    printWriteResult(write_msg_safe(msg));  // Recalc checksums with error set
   }
 
   // Full power cycle to activate error indication
@@ -445,11 +499,11 @@ void lockBatteryForTest() {
 
   // Verify
   if (try_charger(data)) {
-    msg = data + 8;
+    ConstMsgView now(data + 8);
     Serial.print(F("Result: err=0x"));
-    Serial.print(msg[20] & 0x0F, HEX);
+    Serial.print(now.get(MSG_ERROR), HEX);
     Serial.print(F(" chk3=0x"));
-    Serial.print(msg[21] >> 4, HEX);
+    Serial.print(now.get(MSG_CHK3), HEX);
     Serial.print(F(" locked="));
     Serial.println(isBatteryLocked() ? F("YES") : F("NO"));
   }
@@ -464,17 +518,17 @@ void advancedResetMenu() {
   Serial.println(F("  2 - Reset handshake"));
   Serial.println(F("  3 - Set cycle count"));
   Serial.println(F("  4 - LOCK battery (test)"));
+  Serial.println(F("  5 - Unlock strategy statistics"));
   Serial.println(F("  0 - Cancel"));
 
-  while (!Serial.available()) delay(10);
-  char opt = Serial.read();
-  while (Serial.available()) Serial.read();
+  char opt = readKey();
 
   switch (opt) {
     case '1': factoryResetBattery(); break;
     case '2': resetHandshakeState(); break;
     case '3': resetCycleCount(); break;
     case '4': lockBatteryForTest(); break;
+    case '5': printStrategyStats(); break;
     default: Serial.println(F("Cancelled")); break;
   }
 }
@@ -500,25 +554,25 @@ void diagnoseChargerHandshake() {
   }
 
   Serial.println(F("\n[2] Temperature:"));
-  makita.reset();
+  hal_reset();
   delay(100);
   cell_temperature();  // Warm-up
   delay(50);
 
-  float t_cell = cell_temperature();
-  float t_mosfet = mosfet_temperature();
+  int16_t t_cell, t_mosfet;
+  read_temperatures(&t_cell, &t_mosfet);
 
   Serial.print(F("  Cell:   "));
-  if (t_cell > -900) {
-    Serial.print(t_cell, 1);
-    Serial.println((t_cell < 0 || t_cell > 50) ? F("C BAD!") : F("C OK"));
+  if (t_cell != TEMP_NONE) {
+    printFixed(t_cell, 1);
+    Serial.println((t_cell < 0 || t_cell > 500) ? F("C BAD!") : F("C OK"));
   } else {
     Serial.println(F("NO RESPONSE!"));
   }
 
   Serial.print(F("  MOSFET: "));
-  if (t_mosfet > -900) {
-    Serial.print(t_mosfet, 1);
+  if (t_mosfet != TEMP_NONE) {
+    printFixed(t_mosfet, 1);
     Serial.println(F("C"));
   } else {
     Serial.println(F("NO RESPONSE"));
@@ -533,7 +587,7 @@ void diagnoseChargerHandshake() {
   Serial.println(has_health() ? F("  NEW (has_health)") : F("  OLD"));
 
   printSeparator();
-  bool temp_ok = (t_cell > 0 && t_cell < 50);
+  bool temp_ok = (t_cell != TEMP_NONE && t_cell > 0 && t_cell < 500);
   Serial.println(temp_ok ? F("All checks PASSED") : F("Temperature issue detected"));
   printSeparator();
 }
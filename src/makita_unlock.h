@@ -6,15 +6,18 @@
 #define MAKITA_UNLOCK_H
 
 #include "config.h"
+#include "makita_task.h"
 
 // MSG operations
 void saveMSG();
 void compareMSG();
 void cloneMSG();
+const byte* savedMSG();  // MSG saved with 's', NULL if none
 
 // Reset operations
 void resetBatteryErrors();
 void unlockBattery();
+uint8_t unlockBatteryTask(Task* t);  // Background version of unlockBattery()
 void factoryResetBattery();
 void resetHandshakeState();
 void resetCycleCount();